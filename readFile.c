@@ -6,14 +6,57 @@
  * <https://creativecommons.org/publicdomain/zero/1.0/> for information.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE		// clock_gettime and posix_fadvise under -std=c99
+#endif
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef _MSC_VER
 	// Microsoft C (Windows)
 	#include <malloc.h>		// Microsoft help says realloc requires it.
+	#include <windows.h>	// for CreateFileMapping and MapViewOfFile
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#ifdef __linux__
+		#include <sys/vfs.h>		// statfs
+	#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+		#include <sys/param.h>
+		#include <sys/mount.h>		// statfs and MNT_LOCAL
+	#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define READFILE_X86 1
+	#include <immintrin.h>		// SSE2 and AVX2 intrinsics
+	#ifdef _MSC_VER
+		#include <intrin.h>		// __cpuidex, _BitScanForward
+	#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define READFILE_NEON 1
+	#include <arm_neon.h>
+#endif
+
+#ifndef READFILE_NO_THREADS
+	#ifdef _MSC_VER
+		#include <process.h>	// _beginthreadex
+	#else
+		#include <pthread.h>
+	#endif
+#endif
+
+#ifdef READFILE_ZLIB
+	#include <zlib.h>			// gzip decompression; link with -lz
+#endif
+#ifdef READFILE_ZSTD
+	#include <zstd.h>			// zstd decompression; link with -lzstd
 #endif
 
 #include "readFile.h"
@@ -32,211 +75,5243 @@ char rcsid_readFile[] =
 	#define errno_t int
 #endif
 
-#ifdef TRUE
-    #undef TRUE
-#endif
-#define TRUE 1
+#ifdef TRUE
+    #undef TRUE
+#endif
+#define TRUE 1
+
+#ifdef FALSE
+    #undef FALSE
+#endif
+#define FALSE 0
+
+/*
+copySpan copies chars from s to d until it finds c1 or c2 or has copied n
+chars, and returns the number of chars copied.  d must not be after s; when
+d == s nothing is stored and copySpan is a pure scan.  copySpan calls the
+fastest kernel the running CPU supports: AVX2 (32 chars per iteration) or
+SSE2 (16) on x86, NEON (16) on ARM, otherwise a scalar loop.  The kernel is
+chosen once, on the first call, through pthread_once (InitOnceExecuteOnce
+on Windows), so threads may make their first calls together.  A whole
+vector is stored for a block containing c1 or c2 only if d is at least a
+vector behind s, so chars not yet read are never overwritten.  If c2 is
+SPAN_HIGH, copySpan stops at c1 or at any char of 0x80 or more, where UTF-8
+sequences begin.
+*/
+typedef size_t (*CopySpanFn)(char *d, const char *s, size_t n, int c1, int c2);
+
+#define SPAN_HIGH 0x100
+
+static size_t
+copySpanScalar(char *d, const char *s, size_t n, int c1, int c2)
+{
+    const unsigned top = c2 == SPAN_HIGH ? 0x80 : 0x100;
+    const char a = (char)c1, b = c2 == SPAN_HIGH ? a : (char)c2;
+    size_t i = 0;
+
+    if (d == s) {
+        while (i < n && s[i] != a && s[i] != b && (unsigned char)s[i] < top)
+            ++i;
+    } else {
+        for (; i < n && s[i] != a && s[i] != b &&
+                (unsigned char)s[i] < top; ++i)
+            d[i] = s[i];
+    }
+    return i;
+}
+
+#if defined(READFILE_X86) || defined(READFILE_NEON)
+// lowBit returns the index of the lowest set bit of non-zero m.
+static unsigned
+lowBit(uint64_t m)
+{
+    #ifdef _MSC_VER
+      unsigned long i;
+      #ifdef _M_IX86
+        if (!_BitScanForward(&i, (unsigned long)m)) {
+            _BitScanForward(&i, (unsigned long)(m >> 32));
+            i += 32;
+        }
+      #else
+        _BitScanForward64(&i, m);
+      #endif
+      return (unsigned)i;
+    #else
+      return (unsigned)__builtin_ctzll(m);
+    #endif
+}
+#endif
+
+#ifdef READFILE_X86
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define READFILE_SSE2 1
+#endif
+
+#ifdef READFILE_SSE2
+static size_t
+copySpanSSE2(char *d, const char *s, size_t n, int c1, int c2)
+{
+    const int high = c2 == SPAN_HIGH;
+    const __m128i va = _mm_set1_epi8((char)c1);
+    const __m128i vb = _mm_set1_epi8((char)(high ? c1 : c2));
+    const unsigned hm = high ? 0xffff : 0;  // high bits that stop the span
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))) |
+                ((unsigned)_mm_movemask_epi8(v) & hm);
+        if (m) {
+            unsigned k = lowBit(m);
+            if (s - d >= 16)      // the store can't reach unread chars
+                _mm_storeu_si128((__m128i *)(d + i), v);
+            else if (d != s)
+                memmove(d + i, s + i, k);
+            return i + k;
+        }
+        if (d != s)
+            _mm_storeu_si128((__m128i *)(d + i), v);
+    }
+    return i + copySpanScalar(d + i, s + i, n - i, c1, c2);
+}
+#endif
+
+#if defined(__GNUC__) || defined(_MSC_VER)
+    #define READFILE_AVX2 1
+#endif
+
+#ifdef READFILE_AVX2
+#ifdef __GNUC__
+__attribute__((target("avx2")))
+#endif
+static size_t
+copySpanAVX2(char *d, const char *s, size_t n, int c1, int c2)
+{
+    const int high = c2 == SPAN_HIGH;
+    const __m256i va = _mm256_set1_epi8((char)c1);
+    const __m256i vb = _mm256_set1_epi8((char)(high ? c1 : c2));
+    const unsigned hm = high ? 0xffffffffu : 0;  // high bits that stop the span
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))) |
+            ((unsigned)_mm256_movemask_epi8(v) & hm);
+        if (m) {
+            unsigned k = lowBit(m);
+            if (s - d >= 32)      // the store can't reach unread chars
+                _mm256_storeu_si256((__m256i *)(d + i), v);
+            else if (d != s)
+                memmove(d + i, s + i, k);
+            return i + k;
+        }
+        if (d != s)
+            _mm256_storeu_si256((__m256i *)(d + i), v);
+    }
+    return i + copySpanScalar(d + i, s + i, n - i, c1, c2);
+}
+
+// hasAVX2 returns TRUE if the CPU and operating system support AVX2.
+static int
+hasAVX2(void)
+{
+    #ifdef _MSC_VER
+      int r[4];
+      __cpuid(r, 0);
+      if (r[0] < 7)
+          return FALSE;
+      __cpuid(r, 1);
+      if ((r[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)  // OSXSAVE, YMM
+          return FALSE;
+      __cpuidex(r, 7, 0);
+      return (r[1] & (1 << 5)) != 0;
+    #else
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+    #endif
+}
+#endif
+#endif  // READFILE_X86
+
+#ifdef READFILE_NEON
+static size_t
+copySpanNEON(char *d, const char *s, size_t n, int c1, int c2)
+{
+    const int high = c2 == SPAN_HIGH;
+    const uint8x16_t va = vdupq_n_u8((uint8_t)c1);
+    const uint8x16_t vb = vdupq_n_u8((uint8_t)(high ? c1 : c2));
+    const uint8x16_t vh = vdupq_n_u8(high ? 0x80 : 0);  // bit that stops it
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(s + i));
+        uint8x16_t eq = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+                vtstq_u8(v, vh));
+        // Narrow each 8-bit lane to 4 bits: a 64-bit "movemask".
+        uint64_t m = vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (m) {
+            unsigned k = lowBit(m) >> 2;
+            if (s - d >= 16)      // the store can't reach unread chars
+                vst1q_u8((uint8_t *)(d + i), v);
+            else if (d != s)
+                memmove(d + i, s + i, k);
+            return i + k;
+        }
+        if (d != s)
+            vst1q_u8((uint8_t *)(d + i), v);
+    }
+    return i + copySpanScalar(d + i, s + i, n - i, c1, c2);
+}
+#endif
+
+/*
+utf8Check checks the n chars at s, n being a multiple of UTF8_BLOCK, for
+UTF-8 errors by the lookup-table method of Keiser and Lemire ("Validating
+UTF-8 In Less Than One Instruction Per Byte", 2021).  Each char is classed
+by three 16-entry tables, indexed by the high and low halves of the char
+before it and by its own high half; the classes are ANDed, and a set bit
+is an error, except that bit 0x80 must be set for the third and fourth
+chars of a sequence.  tail holds the 3 chars before s, as read, and is set
+to the last 3 chars at s on return.  A sequence cut off at s + n is not an
+error here; it is found by the next call, whose chars don't continue it.
+utf8Check returns TRUE if no error was found.  It calls the fastest kernel
+the running CPU supports: AVX2 (32 chars per iteration) or SSSE3 (16) on
+x86, NEON (16) on ARM, otherwise a scalar loop that uses the same tables.
+The kernel is chosen along with copySpan's.
+*/
+typedef int (*Utf8CheckFn)(const char *s, size_t n, unsigned char tail[3]);
+
+#define UTF8_BLOCK 32
+
+#define U8_TOO_SHORT   0x01     // a lead not followed by a continuation
+#define U8_TOO_LONG    0x02     // a continuation after ASCII
+#define U8_OVERLONG_3  0x04     // 0xe0 then 0x80-0x9f
+#define U8_TOO_LARGE   0x08     // beyond U+10FFFF
+#define U8_SURROGATE   0x10     // 0xed then 0xa0-0xbf
+#define U8_OVERLONG_2  0x20     // 0xc0 or 0xc1
+#define U8_TOO_LARGE_1000 0x40  // 0xf5 or more then 0x80-0x8f
+#define U8_OVERLONG_4  0x40     // 0xf0 then 0x80-0x8f
+#define U8_TWO_CONTS   0x80     // a continuation after a continuation
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+static const unsigned char utf8Byte1High[16] = {  // high half, char before
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+    U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+    U8_TOO_SHORT | U8_OVERLONG_2,
+    U8_TOO_SHORT,
+    U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+    U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+};
+
+static const unsigned char utf8Byte1Low[16] = {   // low half, char before
+    U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+    U8_CARRY | U8_OVERLONG_2,
+    U8_CARRY,
+    U8_CARRY,
+    U8_CARRY | U8_TOO_LARGE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000
+};
+
+static const unsigned char utf8Byte2High[16] = {  // high half, the char
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |
+            U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |
+            U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE |
+            U8_TOO_LARGE,
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE |
+            U8_TOO_LARGE,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+};
+
+#if defined(READFILE_X86) || defined(READFILE_NEON)
+// utf8Incomplete is subtracted, saturating, from a vector's last chars to
+// find a sequence that the next vector must continue.
+static const unsigned char utf8Incomplete[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf
+};
+#endif
+
+static int
+utf8CheckScalar(const char *s, size_t n, unsigned char tail[3])
+{
+    const unsigned char *u = (const unsigned char *)s;
+    unsigned p1 = tail[2], p2 = tail[1], p3 = tail[0], c, err = 0;
+    uint64_t w;
+    size_t i = 0;
+
+    while (i < n) {
+        if (p1 < 0x80 && i + 8 <= n) {     // skip 8 chars of ASCII
+            memcpy(&w, u + i, 8);
+            if (!(w & 0x8080808080808080ull)) {
+                i += 8;
+                p3 = u[i - 3], p2 = u[i - 2], p1 = u[i - 1];
+                continue;
+            }
+        }
+        c = u[i++];
+        err |= (utf8Byte1High[p1 >> 4] & utf8Byte1Low[p1 & 15] &
+                utf8Byte2High[c >> 4]) ^ (p2 >= 0xe0 || p3 >= 0xf0 ? 0x80 : 0);
+        p3 = p2, p2 = p1, p1 = c;
+    }
+    tail[0] = (unsigned char)p3, tail[1] = (unsigned char)p2;
+    tail[2] = (unsigned char)p1;
+    return !err;
+}
+
+#ifdef READFILE_X86
+// hasSSSE3 returns TRUE if the CPU supports SSSE3.
+static int
+hasSSSE3(void)
+{
+    #ifdef _MSC_VER
+      int r[4];
+      __cpuid(r, 1);
+      return (r[2] & (1 << 9)) != 0;
+    #else
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("ssse3");
+    #endif
+}
+
+#ifdef __GNUC__
+__attribute__((target("ssse3")))
+#endif
+static int
+utf8CheckSSSE3(const char *s, size_t n, unsigned char tail[3])
+{
+    const __m128i t1 = _mm_loadu_si128((const __m128i *)utf8Byte1High);
+    const __m128i t2 = _mm_loadu_si128((const __m128i *)utf8Byte1Low);
+    const __m128i t3 = _mm_loadu_si128((const __m128i *)utf8Byte2High);
+    const __m128i inc = _mm_loadu_si128((const __m128i *)(utf8Incomplete + 16));
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i prev = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            (char)tail[0], (char)tail[1], (char)tail[2]);
+    __m128i err = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i < n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        if (!_mm_movemask_epi8(v)) {     // ASCII: only a cut-off sequence
+            err = _mm_or_si128(err, _mm_subs_epu8(prev, inc));
+        } else {
+            __m128i p1 = _mm_alignr_epi8(v, prev, 15);
+            __m128i p2 = _mm_alignr_epi8(v, prev, 14);
+            __m128i p3 = _mm_alignr_epi8(v, prev, 13);
+            __m128i sc = _mm_and_si128(_mm_and_si128(
+                    _mm_shuffle_epi8(t1, _mm_and_si128(_mm_srli_epi16(p1, 4),
+                        low)),
+                    _mm_shuffle_epi8(t2, _mm_and_si128(p1, low))),
+                    _mm_shuffle_epi8(t3, _mm_and_si128(_mm_srli_epi16(v, 4),
+                        low)));
+            __m128i must = _mm_and_si128(_mm_or_si128(
+                    _mm_subs_epu8(p2, _mm_set1_epi8(0xe0 - 0x80)),
+                    _mm_subs_epu8(p3, _mm_set1_epi8(0xf0 - 0x80))),
+                    _mm_set1_epi8((char)0x80));
+            err = _mm_or_si128(err, _mm_xor_si128(must, sc));
+        }
+        prev = v;
+    }
+    memcpy(tail, s + n - 3, 3);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) ==
+            0xffff;
+}
+
+#ifdef READFILE_AVX2
+#ifdef __GNUC__
+__attribute__((target("avx2")))
+#endif
+static int
+utf8CheckAVX2(const char *s, size_t n, unsigned char tail[3])
+{
+    const __m256i t1 = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)utf8Byte1High));
+    const __m256i t2 = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)utf8Byte1Low));
+    const __m256i t3 = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)utf8Byte2High));
+    const __m256i inc = _mm256_loadu_si256((const __m256i *)utf8Incomplete);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i prev = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            (char)tail[0], (char)tail[1], (char)tail[2]);
+    __m256i err = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i < n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        if (!_mm256_movemask_epi8(v)) {  // ASCII: only a cut-off sequence
+            err = _mm256_or_si256(err, _mm256_subs_epu8(prev, inc));
+        } else {
+            // The 16 chars before each lane's, for alignr to shift in.
+            __m256i b = _mm256_permute2x128_si256(prev, v, 0x21);
+            __m256i p1 = _mm256_alignr_epi8(v, b, 15);
+            __m256i p2 = _mm256_alignr_epi8(v, b, 14);
+            __m256i p3 = _mm256_alignr_epi8(v, b, 13);
+            __m256i sc = _mm256_and_si256(_mm256_and_si256(
+                    _mm256_shuffle_epi8(t1, _mm256_and_si256(
+                        _mm256_srli_epi16(p1, 4), low)),
+                    _mm256_shuffle_epi8(t2, _mm256_and_si256(p1, low))),
+                    _mm256_shuffle_epi8(t3, _mm256_and_si256(
+                        _mm256_srli_epi16(v, 4), low)));
+            __m256i must = _mm256_and_si256(_mm256_or_si256(
+                    _mm256_subs_epu8(p2, _mm256_set1_epi8(0xe0 - 0x80)),
+                    _mm256_subs_epu8(p3, _mm256_set1_epi8(0xf0 - 0x80))),
+                    _mm256_set1_epi8((char)0x80));
+            err = _mm256_or_si256(err, _mm256_xor_si256(must, sc));
+        }
+        prev = v;
+    }
+    memcpy(tail, s + n - 3, 3);
+    return _mm256_testz_si256(err, err);
+}
+#endif
+#endif  // READFILE_X86
+
+#ifdef READFILE_NEON
+static int
+utf8CheckNEON(const char *s, size_t n, unsigned char tail[3])
+{
+    const uint8x16_t t1 = vld1q_u8(utf8Byte1High);
+    const uint8x16_t t2 = vld1q_u8(utf8Byte1Low);
+    const uint8x16_t t3 = vld1q_u8(utf8Byte2High);
+    const uint8x16_t inc = vld1q_u8(utf8Incomplete + 16);
+    const uint8x16_t low = vdupq_n_u8(0x0f);
+    uint8_t first[16] = {0};
+    uint8x16_t prev, err = vdupq_n_u8(0);
+    size_t i;
+
+    memcpy(first + 13, tail, 3);
+    prev = vld1q_u8(first);
+    for (i = 0; i < n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(s + i));
+        if (vmaxvq_u8(v) < 0x80) {     // ASCII: only a cut-off sequence
+            err = vorrq_u8(err, vqsubq_u8(prev, inc));
+        } else {
+            uint8x16_t p1 = vextq_u8(prev, v, 15);
+            uint8x16_t p2 = vextq_u8(prev, v, 14);
+            uint8x16_t p3 = vextq_u8(prev, v, 13);
+            uint8x16_t sc = vandq_u8(vandq_u8(
+                    vqtbl1q_u8(t1, vshrq_n_u8(p1, 4)),
+                    vqtbl1q_u8(t2, vandq_u8(p1, low))),
+                    vqtbl1q_u8(t3, vshrq_n_u8(v, 4)));
+            uint8x16_t must = vandq_u8(vorrq_u8(
+                    vqsubq_u8(p2, vdupq_n_u8(0xe0 - 0x80)),
+                    vqsubq_u8(p3, vdupq_n_u8(0xf0 - 0x80))),
+                    vdupq_n_u8(0x80));
+            err = vorrq_u8(err, veorq_u8(must, sc));
+        }
+        prev = v;
+    }
+    memcpy(tail, s + n - 3, 3);
+    return vmaxvq_u8(err) == 0;
+}
+#endif
+
+static CopySpanFn copySpanKernel;   // set once, by kernelPick
+static Utf8CheckFn utf8CheckKernel; // likewise
+
+static void
+kernelPick(void)
+{
+    CopySpanFn f = copySpanScalar;
+    Utf8CheckFn g = utf8CheckScalar;
+
+    #if defined(READFILE_NEON)
+      f = copySpanNEON;
+      g = utf8CheckNEON;
+    #else
+      #if defined(READFILE_SSE2)
+        f = copySpanSSE2;
+      #endif
+      #if defined(READFILE_X86)
+        if (hasSSSE3())
+            g = utf8CheckSSSE3;
+      #endif
+      #if defined(READFILE_AVX2)
+        if (hasAVX2()) {
+            f = copySpanAVX2;
+            g = utf8CheckAVX2;
+        }
+      #endif
+    #endif
+    utf8CheckKernel = g;
+    copySpanKernel = f;
+}
+
+#ifndef READFILE_NO_THREADS
+  #ifdef _MSC_VER
+    static INIT_ONCE kernelOnce = INIT_ONCE_STATIC_INIT;
+
+    static BOOL CALLBACK
+    kernelPickOnce(PINIT_ONCE once, PVOID param, PVOID *context)
+    {
+        (void)once, (void)param, (void)context;
+        kernelPick();
+        return TRUE;
+    }
+  #else
+    static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+  #endif
+#endif
+
+// kernelInit picks the kernels if that hasn't been done yet.
+static void
+kernelInit(void)
+{
+    #if defined(READFILE_NO_THREADS)
+      if (!copySpanKernel)
+          kernelPick();
+    #elif defined(_MSC_VER)
+      InitOnceExecuteOnce(&kernelOnce, kernelPickOnce, NULL, NULL);
+    #else
+      pthread_once(&kernelOnce, kernelPick);
+    #endif
+}
+
+static size_t
+copySpan(char *d, const char *s, size_t n, int c1, int c2)
+{
+    kernelInit();
+    return copySpanKernel(d, s, n, c1, c2);
+}
+
+static int
+utf8Check(const char *s, size_t n, unsigned char tail[3])
+{
+    kernelInit();
+    return utf8CheckKernel(s, n, tail);
+}
+
+/*
+removeCRLF replaces each "\r\n" in the n chars at buf with "\n" and returns
+the new length.  buf[n] must be readable.  If lfCount is non-NULL the
+linefeeds are counted into *lfCount during the same pass.  Runs free of
+carriage returns (and linefeeds, when counting) are moved a vector at a
+time by copySpan.
+*/
+static size_t
+removeCRLF(char *buf, size_t n, size_t *lfCount)
+{
+    char *d = buf, *s = buf, *end = buf + n;
+    const int c2 = lfCount ? '\n' : '\r';
+    size_t k;
+
+    for (;;) {
+        k = copySpan(d, s, end - s, '\r', c2);
+        d += k;
+        s += k;
+        if (s >= end)
+            break;
+        if (*s == '\n')
+            ++*lfCount;
+        else if (s[1] == '\n') {   // s is at a '\r' to remove
+            ++s;
+            continue;
+        }
+        *d++ = *s++;
+    }
+    return d - buf;
+}
+
+/*
+utf8Length returns the length of the valid UTF-8 sequence beginning with a
+char of 0x80 or more at s, of which n chars are available, or 0 if it's
+invalid: a stray continuation char, an overlong form, a surrogate, a code
+point beyond U+10FFFF, or a sequence cut short.
+*/
+static size_t
+utf8Length(const unsigned char *s, size_t n)
+{
+    const unsigned c = s[0];
+
+    if (c < 0xc2 || c > 0xf4)
+        return 0;
+    if (n < 2 || (s[1] & 0xc0) != 0x80)
+        return 0;
+    if (c < 0xe0)
+        return 2;
+    if (n < 3 || (s[2] & 0xc0) != 0x80 ||
+            (c == 0xe0 && s[1] < 0xa0) || (c == 0xed && s[1] >= 0xa0))
+        return 0;
+    if (c < 0xf0)
+        return 3;
+    if (n < 4 || (s[3] & 0xc0) != 0x80 ||
+            (c == 0xf0 && s[1] < 0x90) || (c == 0xf4 && s[1] >= 0x90))
+        return 0;
+    return 4;
+}
+
+#ifndef READFILE_NO_THREADS
+/*
+A Task is a function call for runTasks to make on its own thread.
+*/
+typedef struct Task {
+    void (*fn)(void *arg);
+    void *arg;
+    int started;        // TRUE if a thread was started for the task
+    #ifdef _MSC_VER
+      HANDLE thread;
+    #else
+      pthread_t thread;
+    #endif
+} Task;
+
+#ifdef _MSC_VER
+static unsigned __stdcall
+taskMain(void *task)
+{
+    ((Task *)task)->fn(((Task *)task)->arg);
+    return 0;
+}
+#else
+static void *
+taskMain(void *task)
+{
+    ((Task *)task)->fn(((Task *)task)->arg);
+    return NULL;
+}
+#endif
+
+// startTask starts a thread for task and sets task->started to TRUE, or
+// sets it to FALSE if the thread can't be started.
+static void
+startTask(Task *task)
+{
+    #ifdef _MSC_VER
+      task->thread = (HANDLE)_beginthreadex(NULL, 0, taskMain, task, 0, NULL);
+      task->started = task->thread != 0;
+    #else
+      task->started = !pthread_create(&task->thread, NULL, taskMain, task);
+    #endif
+}
+
+// joinTask waits for the thread startTask started for task.
+static void
+joinTask(Task *task)
+{
+    #ifdef _MSC_VER
+      WaitForSingleObject(task->thread, INFINITE);
+      CloseHandle(task->thread);
+    #else
+      pthread_join(task->thread, NULL);
+    #endif
+}
+
+/*
+runTasks runs the n tasks concurrently and returns when all are done.  Task
+0 runs on the calling thread, as does any task whose thread can't be
+started, so runTasks cannot fail.
+*/
+static void
+runTasks(Task *tasks, size_t n)
+{
+    size_t i;
+
+    for (i = 1; i < n; ++i)
+        startTask(&tasks[i]);
+    if (n)
+        tasks[0].fn(tasks[0].arg);
+    for (i = 1; i < n; ++i) {
+        if (tasks[i].started)
+            joinTask(&tasks[i]);
+        else
+            tasks[i].fn(tasks[i].arg);
+    }
+}
+
+/*
+startDetached starts a thread for task and lets it run on its own; the
+task must free its own memory.  startDetached returns TRUE if the thread
+was started or sets errno and returns FALSE.
+*/
+static int
+startDetached(Task *task)
+{
+    #ifdef _MSC_VER
+      HANDLE h = (HANDLE)_beginthreadex(NULL, 0, taskMain, task, 0, NULL);
+      if (!h)
+          return FALSE;     // _beginthreadex sets errno
+      CloseHandle(h);
+    #else
+      pthread_t thread;
+      int e = pthread_create(&thread, NULL, taskMain, task);
+      if (e) {
+          errno = e;
+          return FALSE;
+      }
+      pthread_detach(thread);
+    #endif
+    return TRUE;
+}
+
+// onlineCPUs returns the number of processors available, at least 1.
+static size_t
+onlineCPUs(void)
+{
+    #ifdef _MSC_VER
+      SYSTEM_INFO si;
+      GetSystemInfo(&si);
+      return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+    #else
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      return n > 0 ? (size_t)n : 1;
+    #endif
+}
+#endif  // READFILE_NO_THREADS
+
+/*
+rfAlloc, rfRealloc and rfFree allocate, resize and free memory through
+allocator, or through malloc, realloc and free if allocator is NULL.
+errno is set to ENOMEM if an allocator function returns NULL without
+setting errno.
+*/
+static void *
+rfAlloc(const ReadFileAllocator *allocator, size_t size)
+{
+    void *p;
+
+    if (!allocator)
+        return malloc(size);
+    errno = 0;
+    if (!(p = allocator->allocate(allocator->context, size)) && !errno)
+        errno = ENOMEM;
+    return p;
+}
+
+static void *
+rfRealloc(const ReadFileAllocator *allocator, void *p, size_t oldSize,
+        size_t newSize)
+{
+    void *q;
+
+    if (!allocator)
+        return realloc(p, newSize);
+    errno = 0;
+    if (!(q = allocator->reallocate(allocator->context, p, oldSize, newSize))
+            && !errno)
+        errno = ENOMEM;
+    return q;
+}
+
+static void
+rfFree(const ReadFileAllocator *allocator, void *p)
+{
+    if (!allocator)
+        free(p);
+    else if (p)
+        allocator->deallocate(allocator->context, p);
+}
+
+/*
+The rf file functions do native, unbuffered I/O: open/fstat/read on POSIX
+systems and CreateFile/GetFileSizeEx/ReadFile on Windows.  Reading a whole
+file this way takes an open, a stat, one read per gigabyte plus one to see
+the end, and a close, with no stdio buffer in between.
+*/
+#ifdef _MSC_VER
+  typedef HANDLE RfFile;
+  #define RF_NO_FILE INVALID_HANDLE_VALUE
+
+  // setErrnoWin sets errno from GetLastError.
+  static void
+  setErrnoWin(void)
+  {
+      switch (GetLastError()) {
+      case ERROR_FILE_NOT_FOUND:
+      case ERROR_PATH_NOT_FOUND:    errno = ENOENT; break;
+      case ERROR_ACCESS_DENIED:
+      case ERROR_SHARING_VIOLATION: errno = EACCES; break;
+      case ERROR_NOT_ENOUGH_MEMORY:
+      case ERROR_OUTOFMEMORY:       errno = ENOMEM; break;
+      default:                      errno = EIO;    break;
+      }
+  }
+#else
+  typedef int RfFile;
+  #define RF_NO_FILE (-1)
+#endif
+
+// rfOpen opens fileName for reading, or sets errno and returns RF_NO_FILE.
+static RfFile
+rfOpen(const char *fileName)
+{
+    RfFile f;
+
+    #ifdef _MSC_VER
+      f = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ |
+              FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (f == RF_NO_FILE)
+          setErrnoWin();
+    #else
+      do
+          f = open(fileName, O_RDONLY);
+      while (f < 0 && errno == EINTR);
+    #endif
+    return f;
+}
+
+/*
+If readFile.c is compiled with -DREADFILE_HINTS then reads of at least
+HINT_MIN chars get hints.  The input is declared sequential (Windows always
+gets FILE_FLAG_SEQUENTIAL_SCAN from rfOpen) and its pages are requested
+ahead of the read, so the disk keeps streaming.  On Linux, a buffer from
+malloc is also backed by transparent huge pages, which cuts page faults and
+TLB misses while it is filled.  The hints are off by default: requesting a
+whole multi-GB file ahead can evict other data from the page cache, and
+huge pages raise the memory a buffer holds.
+*/
+#define HINT_MIN ((size_t)8 << 20)
+#define HUGE_PAGE ((size_t)2 << 20)
+
+// rfAdviseFile tells the OS that size chars of f will be read in order.
+static void
+rfAdviseFile(RfFile f, size_t size)
+{
+    #if defined(READFILE_HINTS) && defined(POSIX_FADV_SEQUENTIAL)
+      if (size >= HINT_MIN) {
+          posix_fadvise(f, 0, 0, POSIX_FADV_SEQUENTIAL);
+          posix_fadvise(f, 0, size, POSIX_FADV_WILLNEED);
+      }
+    #else
+      (void)f;
+      (void)size;
+    #endif
+}
+
+// rfAdviseBuffer asks for huge pages for the size chars at p, if they came
+// from malloc (allocator is NULL).
+static void
+rfAdviseBuffer(void *p, size_t size, const ReadFileAllocator *allocator)
+{
+    #if defined(READFILE_HINTS) && defined(MADV_HUGEPAGE)
+      uintptr_t start = ((uintptr_t)p + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+      uintptr_t end = ((uintptr_t)p + size) & ~(HUGE_PAGE - 1);
+      if (!allocator && size >= HINT_MIN && start < end)
+          madvise((void *)start, end - start, MADV_HUGEPAGE);
+    #else
+      (void)p;
+      (void)size;
+      (void)allocator;
+    #endif
+}
+
+// rfStdin returns the standard input, which is never closed, or sets errno
+// to EBADF and returns RF_NO_FILE if the process has none (as a Windows GUI
+// process or one detached from its console may not).
+static RfFile
+rfStdin(void)
+{
+    #ifdef _MSC_VER
+      HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
+      if (h == NULL || h == INVALID_HANDLE_VALUE) {
+          errno = EBADF;
+          return RF_NO_FILE;
+      }
+      return h;
+    #else
+      return 0;
+    #endif
+}
+
+/*
+rfSize stores the size of open file f in *size and returns TRUE, or sets
+errno and returns FALSE.  *sized is set to TRUE for a regular file or a
+disk, whose size can be known in advance.  For anything else, such as a
+pipe, socket or terminal, *sized is set to FALSE and *size to 0; such a file
+must be read until its end to find its size.
+*/
+static int
+rfSize(RfFile f, size_t *size, int *sized)
+{
+    *size = 0;
+    *sized = FALSE;
+    #ifdef _MSC_VER
+      LARGE_INTEGER sz;
+      if (GetFileType(f) == FILE_TYPE_DISK) {
+          if (!GetFileSizeEx(f, &sz)) {
+              setErrnoWin();
+              return FALSE;
+          }
+          if ((unsigned long long)sz.QuadPart > SIZE_MAX) {
+              errno = EFBIG;
+              return FALSE;
+          }
+          *size = (size_t)sz.QuadPart;
+          *sized = TRUE;
+      }
+    #else
+      struct stat st;
+      off_t end;
+      if (fstat(f, &st))
+          return FALSE;
+      if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+          end = st.st_size;
+          if (S_ISBLK(st.st_mode) &&    // a disk's stat size is 0
+                  ((end = lseek(f, 0, SEEK_END)) < 0 ||
+                   lseek(f, 0, SEEK_SET) < 0))
+              return FALSE;
+          if ((unsigned long long)end > SIZE_MAX) {
+              errno = EFBIG;
+              return FALSE;
+          }
+          *size = (size_t)end;
+          *sized = TRUE;
+      }
+    #endif
+    return TRUE;
+}
+
+/*
+rfSizeByName stores in *size the size of the file named fileName, without
+opening it, and returns TRUE if it is a regular file of non-zero size that
+fits in a size_t.  Otherwise it returns FALSE; opening the file then tells
+what it is, or why it can't be read.
+*/
+static int
+rfSizeByName(const char *fileName, size_t *size)
+{
+    unsigned long long sz;
+
+    #ifdef _MSC_VER
+      WIN32_FILE_ATTRIBUTE_DATA a;
+      if (!GetFileAttributesExA(fileName, GetFileExInfoStandard, &a) ||
+              (a.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+          return FALSE;
+      sz = (unsigned long long)a.nFileSizeHigh << 32 | a.nFileSizeLow;
+    #else
+      struct stat st;
+      if (stat(fileName, &st) || !S_ISREG(st.st_mode))
+          return FALSE;
+      sz = (unsigned long long)st.st_size;
+    #endif
+    if (!sz || sz > SIZE_MAX)
+        return FALSE;
+    *size = (size_t)sz;
+    return TRUE;
+}
+
+/*
+rfRead reads up to n chars from f into buf, stopping early only at end of
+file, and returns the number read.  If an error occurs, errno is set and
+(size_t)-1 is returned.
+*/
+static size_t
+rfRead(RfFile f, char *buf, size_t n)
+{
+    const size_t most = (size_t)1 << 30;    // per call; some OSes take < 2 GB
+    size_t done = 0, want;
+
+    while (done < n) {
+        want = n - done < most ? n - done : most;
+        #ifdef _MSC_VER
+          DWORD got;
+          if (!ReadFile(f, buf + done, (DWORD)want, &got, NULL)) {
+              setErrnoWin();
+              return (size_t)-1;
+          }
+        #else
+          ssize_t got = read(f, buf + done, want);
+          if (got < 0) {
+              if (errno == EINTR)
+                  continue;
+              return (size_t)-1;
+          }
+        #endif
+        if (!got)
+            break;
+        done += (size_t)got;
+    }
+    return done;
+}
+
+/*
+rfReadAt reads up to n chars at offset in f into buf as rfRead does, but
+without using or moving f's file position, so any part of a file can be
+read directly.
+*/
+static size_t
+rfReadAt(RfFile f, char *buf, size_t n, size_t offset)
+{
+    const size_t most = (size_t)1 << 30;    // per call; some OSes take < 2 GB
+    size_t done = 0, want;
+
+    while (done < n) {
+        want = n - done < most ? n - done : most;
+        #ifdef _MSC_VER
+          DWORD got;
+          OVERLAPPED at;
+          unsigned long long pos = (unsigned long long)offset + done;
+          memset(&at, 0, sizeof(at));
+          at.Offset = (DWORD)pos;
+          at.OffsetHigh = (DWORD)(pos >> 32);
+          if (!ReadFile(f, buf + done, (DWORD)want, &got, &at)) {
+              if (GetLastError() == ERROR_HANDLE_EOF)
+                  break;
+              setErrnoWin();
+              return (size_t)-1;
+          }
+        #else
+          ssize_t got = pread(f, buf + done, want, (off_t)(offset + done));
+          if (got < 0) {
+              if (errno == EINTR)
+                  continue;
+              return (size_t)-1;
+          }
+        #endif
+        if (!got)
+            break;
+        done += (size_t)got;
+    }
+    return done;
+}
+
+// rfClose closes f.
+static void
+rfClose(RfFile f)
+{
+    #ifdef _MSC_VER
+      CloseHandle(f);
+    #else
+      close(f);
+    #endif
+}
+
+// rfNow returns a monotonic time in nanoseconds.
+static uint64_t
+rfNow(void)
+{
+    #ifdef _MSC_VER
+      LARGE_INTEGER t, f;
+      QueryPerformanceCounter(&t);
+      QueryPerformanceFrequency(&f);
+      return (uint64_t)(t.QuadPart / f.QuadPart * 1000000000 +
+              t.QuadPart % f.QuadPart * 1000000000 / f.QuadPart);
+    #else
+      struct timespec t;
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+    #endif
+}
+
+// rfLap returns the nanoseconds since *mark and sets *mark to now.
+static uint64_t
+rfLap(uint64_t *mark)
+{
+    uint64_t now = rfNow(), ns = now - *mark;
+
+    *mark = now;
+    return ns;
+}
+
+/*
+A LineSink collects the lines splitText finds, as pointers into the text
+for readLines or as offsets from its start for readLinesIndex.  The array
+begins with head chars (the hidden buffer pointer or a LineIndex) and keeps
+one spare entry after the lines for readLines' NULL or readLinesIndex's
+end offset.  If lengths is TRUE, a size_t length per line follows the spare
+entry once the lines are all found.  Lines end at '\n' unless delim is set,
+after sinkInit, to the delimLen chars that end readRecords' records.
+*/
+enum { SINK_POINTERS, SINK_OFFSETS32, SINK_OFFSETS64 };
+
+typedef struct LineSink {
+    int kind;           // SINK_POINTERS, SINK_OFFSETS32 or SINK_OFFSETS64
+    size_t width;       // size of an entry in chars
+    size_t head;        // chars before the first entry
+    int lengths;        // TRUE to append line lengths (SINK_POINTERS only)
+    char *a;            // the array
+    size_t cap;         // entries reserved, not counting the spare one
+    size_t cnt;         // entries stored
+    int trim;           // TRUE to free unused entries when done
+    size_t maxSize;     // limit on array and text, or 0 for none
+    const ReadFileAllocator *allocator;     // NULL for malloc
+    const char *delim;  // what ends a record, or NULL for lines
+    size_t delimLen;    // length of delim
+} LineSink;
+
+/*
+sinkLimit returns the maximum number of entries that fit in sink's maxSize
+chars beside used chars of text and its '\0'.  There is no limit if
+maxSize is zero.
+*/
+static size_t
+sinkLimit(const LineSink *sink, size_t used)
+{
+    size_t fixed = sink->head + sink->width;    // head and spare entry
+    size_t each = sink->width + (sink->lengths ? sizeof(size_t) : 0);
+
+    if (!sink->maxSize)
+        return (SIZE_MAX - fixed) / each;
+    if (used >= sink->maxSize || sink->maxSize - used - 1 < fixed)
+        return 0;
+    return (sink->maxSize - used - 1 - fixed) / each;
+}
+
+// sinkSize returns the size in chars of sink's array holding cnt entries.
+static size_t
+sinkSize(const LineSink *sink, size_t cnt)
+{
+    return sink->head + (cnt + 1) * sink->width +
+            (sink->lengths ? cnt * sizeof(size_t) : 0);
+}
+
+/*
+sinkInit prepares sink to collect lines of the given kind.  See LineSink for
+head and lengths.  The array will come from allocator.  To have sink reuse
+an existing array instead, set sink->a, sink->cap and sink->trim = FALSE
+after calling sinkInit.
+*/
+static void
+sinkInit(LineSink *sink, int kind, size_t head, int lengths, size_t maxSize,
+        const ReadFileAllocator *allocator)
+{
+    sink->allocator = allocator;
+    sink->kind = kind;
+    sink->lengths = lengths;
+    sink->width = kind == SINK_POINTERS ? sizeof(char *) :
+            kind == SINK_OFFSETS32 ? sizeof(uint32_t) : sizeof(uint64_t);
+    sink->head = head;
+    sink->maxSize = maxSize;
+    sink->a = NULL;
+    sink->cap = sink->cnt = 0;
+    sink->trim = TRUE;
+    sink->delim = NULL;
+    sink->delimLen = 0;
+}
+
+/*
+sinkReserve allocates sink's array, if it has none, with entries for the
+lines in the n chars of text that will be split.  sinkReserve returns FALSE
+with errno set if memory is exhausted.
+*/
+static int
+sinkReserve(LineSink *sink, size_t n)
+{
+    if (!sink->a) {
+        sink->cap = n / 32 + 8;     // over-reserved; doubled as needed
+        if (sink->cap > sinkLimit(sink, 0))
+            sink->cap = sinkLimit(sink, 0);
+        sink->a = rfAlloc(sink->allocator, sinkSize(sink, sink->cap));
+        if (sink->a)
+            rfAdviseBuffer(sink->a, sinkSize(sink, sink->cap), sink->allocator);
+    }
+    return sink->a != NULL;
+}
+
+// sinkPut stores p or off, depending on sink's kind, as entry i.
+static void
+sinkPut(LineSink *sink, size_t i, char *p, size_t off)
+{
+    switch (sink->kind) {
+    case SINK_POINTERS:
+        ((char **)(sink->a + sink->head))[i] = p;
+        break;
+    case SINK_OFFSETS32:
+        ((uint32_t *)(sink->a + sink->head))[i] = (uint32_t)off;
+        break;
+    default:
+        ((uint64_t *)(sink->a + sink->head))[i] = off;
+        break;
+    }
+}
+
+/*
+sinkAdd stores line start off as the next entry in sink, doubling the
+entries reserved when they are all used.  buf is the text.  sinkAdd returns
+FALSE with errno set if the entries can't grow within maxSize (given used
+chars of text) or memory is exhausted; sink->a is then still valid.
+*/
+static int
+sinkAdd(LineSink *sink, char *buf, size_t off, size_t used)
+{
+    if (sink->cnt == sink->cap) {
+        size_t limit = sinkLimit(sink, used);
+        size_t want = sink->cap ? sink->cap * 2 : 8;
+        char *b;
+
+        if (want > limit)
+            want = limit;
+        if (want <= sink->cnt) {
+            errno = EFBIG;
+            return FALSE;
+        }
+        if (!(b = rfRealloc(sink->allocator, sink->a,
+                sinkSize(sink, sink->cap), sinkSize(sink, want))))
+            return FALSE;
+        sink->a = b;
+        sink->cap = want;
+    }
+    sinkPut(sink, sink->cnt++, buf + off, off);
+    return TRUE;
+}
+
+/*
+A Scan is the one pass over the text that removes carriage returns and, if
+sink is not NULL, splits lines, done by scanRun on as much of the text as
+has arrived so far.  With a sink, "\r\n" becomes "\n", each '\n' becomes
+'\0', and line starts are recorded; without one, only "\r\n" becomes "\n",
+as in text mode.  copySpan moves the runs between carriage returns and
+linefeeds a vector at a time.  Kept chars are moved toward buf, never past
+the scan, so text beyond the scan may still be arriving.
+*/
+typedef struct Scan {
+    char *buf;          // start of the text
+    char *d;            // where the next kept char goes
+    char *s;            // next char to scan
+    char *start;        // start of the current line
+    LineSink *sink;     // where line starts go, or NULL to keep lines whole
+    struct Utf8Scan *utf8;  // the UTF-8 check to make, or NULL
+    int ok;             // FALSE once sinkAdd has failed
+} Scan;
+
+/*
+A Utf8Scan is the state of the UTF-8 check that a Scan without a sink makes
+for readFileUtf8.  Carriage returns are removed only if crlf is TRUE.
+*/
+typedef struct Utf8Scan {
+    int crlf;           // TRUE to replace each "\r\n" with "\n" too
+    int begun;          // TRUE once a leading byte order mark is handled
+    char *v;            // the chars before v have been checked
+    unsigned char tail[3];  // the last 3 chars checked, as read
+    size_t invalid;     // offset of the first invalid char, or (size_t)-1
+} Utf8Scan;
+
+static void
+scanInit(Scan *sc, char *buf, LineSink *sink, Utf8Scan *utf8)
+{
+    sc->buf = sc->d = sc->s = sc->start = buf;
+    sc->sink = sink;
+    sc->ok = TRUE;
+    if ((sc->utf8 = utf8) != NULL) {
+        utf8->begun = FALSE;
+        utf8->v = buf;
+        memset(utf8->tail, 0, sizeof(utf8->tail));
+        utf8->invalid = (size_t)-1;
+    }
+}
+
+/*
+scanDelim is scanRun for a sink with a delimiter: each delimiter becomes a
+'\0' and carriage returns are kept.  copySpan stops at the delimiter's first
+char.  A delimiter that may be cut off by limit is left for the next call
+unless final is TRUE.
+*/
+static void
+scanDelim(Scan *sc, char *limit, int final)
+{
+    char *d = sc->d, *s = sc->s, *start = sc->start, *buf = sc->buf;
+    const char *delim = sc->sink->delim;
+    size_t len = sc->sink->delimLen, k;
+
+    while (sc->ok) {
+        k = copySpan(d, s, limit - s, delim[0], delim[0]);
+        d += k;
+        s += k;
+        if (s >= limit)
+            break;
+        if ((size_t)(limit - s) < len) {
+            if (!final)
+                break;
+            *d++ = *s++;    // too near the end to be a delimiter
+            continue;
+        }
+        if (len > 1 && memcmp(s + 1, delim + 1, len - 1)) {
+            *d++ = *s++;
+            continue;
+        }
+        if (!(sc->ok = sinkAdd(sc->sink, buf, start - buf, d - buf)))
+            break;
+        *d++ = '\0';
+        start = d;
+        s += len;
+    }
+    sc->d = d;
+    sc->s = s;
+    sc->start = start;
+}
+
+/*
+scanUtf8 is scanRun for a Scan with a UTF-8 check, up to the first invalid
+char.  A leading byte order mark is dropped.  utf8Check checks UTF8_STRIDE
+chars at a time, whose carriage returns are then removed while they are
+still in cache.  Unless final is TRUE the last 3 chars before limit are
+left for the next call, so that a sequence cut off by limit can be found
+whole.  If utf8Check finds an error, the stride is gone through again from
+the start of the sequence that the error is in, a sequence at a time, to
+find the first invalid char; its offset in the text is stored in
+u->invalid and sc->s is left at it, for scanRun to go on from.
+*/
+#define UTF8_STRIDE 4096
+
+static void
+scanUtf8(Scan *sc, char *limit, int final)
+{
+    Utf8Scan *u = sc->utf8;
+    char *d = sc->d, *s = sc->s, *e, *buf = sc->buf;
+    const int c1 = u->crlf ? '\r' : 0x80;  // 0x80 stops the span anyway
+    unsigned char last[3], seq[8];
+    char pad[UTF8_BLOCK];
+    size_t m, k, back;
+    int ok, padded = FALSE;
+
+    if (!u->begun) {
+        if (limit - s < 3 && !final)
+            return;
+        if (limit - s >= 3 && !memcmp(s, "\xef\xbb\xbf", 3))
+            s += 3;
+        u->v = s;
+        u->begun = TRUE;
+    }
+    while (u->invalid == (size_t)-1 && !padded) {
+        m = limit - s;      // s is u->v here
+        if (!final)
+            m = m > 3 ? m - 3 : 0;
+        if (m > UTF8_STRIDE)
+            m = UTF8_STRIDE;
+        m -= m % UTF8_BLOCK;
+        memcpy(last, u->tail, 3);
+        if (m) {
+            e = s + m;
+            ok = utf8Check(s, m, u->tail);
+        } else if (final) {     // the last chars, followed by ASCII
+            memset(pad, 0, sizeof(pad));
+            memcpy(pad, s, limit - s);
+            e = limit;
+            ok = utf8Check(pad, UTF8_BLOCK, u->tail);
+            padded = TRUE;
+        } else
+            break;
+        if (ok && u->crlf) {
+            while (s < e) {
+                k = copySpan(d, s, e - s, '\r', '\r');
+                d += k;
+                s += k;
+                if (s >= e)
+                    break;
+                if (s[1] != '\n')
+                    *d++ = '\r';
+                ++s;
+            }
+        } else if (ok) {
+            if (d != s)
+                memmove(d, s, e - s);
+            d += e - s;
+            s = e;
+        } else {
+            // The chars of a sequence begun before s were kept as read.
+            back = last[2] >= 0xc0 ? 1 : last[1] >= 0xe0 ? 2 :
+                    last[0] >= 0xf0 ? 3 : 0;
+            if (back) {
+                k = limit - s < 3 ? (size_t)(limit - s) : 3;
+                memcpy(seq, last + 3 - back, back);
+                memcpy(seq + back, s, k);
+                if (!(k = utf8Length(seq, back + k)))
+                    u->invalid = (d - back) - buf;
+                for (k = k ? k - back : 0; k; --k)
+                    *d++ = *s++;
+            }
+            while (u->invalid == (size_t)-1 && s < e) {
+                k = copySpan(d, s, e - s, c1, SPAN_HIGH);
+                d += k;
+                s += k;
+                if (s >= e)
+                    break;
+                if (*s == '\r') {
+                    if (s[1] != '\n')
+                        *d++ = '\r';
+                    ++s;
+                } else if ((k = utf8Length((unsigned char *)s,
+                        limit - s)) != 0) {
+                    while (k--)
+                        *d++ = *s++;
+                } else
+                    u->invalid = d - buf;
+            }
+            // s is at a sequence's start, as if after ASCII.
+            memset(u->tail, 0, sizeof(u->tail));
+        }
+        u->v = s;
+    }
+    sc->d = d;
+    sc->s = s;
+}
+
+/*
+scanRun scans the text up to limit.  A '\r' just before limit is left for
+the next call, since whether it is kept depends on the char after it;
+unless final is TRUE, in which case *limit must be '\0'.
+*/
+static void
+scanRun(Scan *sc, char *limit, int final)
+{
+    char *d, *s, *start = sc->start, *buf = sc->buf;
+    const int c2 = sc->sink ? '\n' : '\r';
+    size_t k;
+
+    if (sc->sink && sc->sink->delim) {
+        scanDelim(sc, limit, final);
+        return;
+    }
+    if (sc->utf8 && sc->utf8->invalid == (size_t)-1) {
+        scanUtf8(sc, limit, final);
+        if (sc->utf8->invalid == (size_t)-1)
+            return;
+    }
+    d = sc->d;
+    s = sc->s;
+    if (sc->utf8 && !sc->utf8->crlf) {    // past an invalid char
+        memmove(d, s, limit - s);
+        sc->d = d + (limit - s);
+        sc->s = limit;
+        return;
+    }
+    while (sc->ok) {
+        k = copySpan(d, s, limit - s, '\r', c2);
+        d += k;
+        s += k;
+        if (s >= limit)
+            break;
+        if (*s == '\r') {
+            if (s + 1 == limit && !final)
+                break;
+            if (s[1] != '\n')
+                *d++ = '\r';
+        } else {
+            if (!(sc->ok = sinkAdd(sc->sink, buf, start - buf, d - buf)))
+                break;
+            *d++ = '\0';
+            start = d;
+        }
+        ++s;
+    }
+    sc->d = d;
+    sc->s = s;
+    sc->start = start;
+}
+
+/*
+scanFinish completes a Scan with a sink once scanRun has reached the
+text's end.  A last line with no '\n' is recorded and the text is
+terminated.  The memory limit is checked, unused entries are trimmed if
+sink->trim is TRUE, the spare entry is set to NULL or to the offset just
+past the last line's '\0', and any line lengths are filled in from the
+distances between line starts.  The text's new length is stored in
+*length.  scanFinish returns FALSE with errno set on failure; sink->a is
+then freed.
+*/
+static int
+scanFinish(Scan *sc, size_t *length)
+{
+    LineSink *sink = sc->sink;
+    char *buf = sc->buf, *d = sc->d, *start = sc->start;
+    size_t endOff;
+    int ok = sc->ok;
+    char *b;
+
+    if (ok && d != start)    // line with no '\n' at EOF
+        ok = sinkAdd(sink, buf, start - buf, d - buf);
+    *d = '\0';
+    endOff = (d - buf) + (d != start);
+    if (ok && sink->maxSize && sinkSize(sink, sink->cnt) + (d - buf) + 1 >
+            sink->maxSize) {
+        errno = EFBIG;
+        ok = FALSE;
+    }
+    if (!ok) {
+        rfFree(sink->allocator, sink->a);
+        sink->a = NULL;
+        return FALSE;
+    }
+
+    if (sink->trim && sink->cnt < sink->cap &&
+            (b = rfRealloc(sink->allocator, sink->a, sinkSize(sink, sink->cap),
+                sinkSize(sink, sink->cnt)))) {
+        sink->a = b;
+        sink->cap = sink->cnt;
+    }
+    sinkPut(sink, sink->cnt, NULL, endOff);
+    if (sink->lengths) {
+        char **ln = (char **)(sink->a + sink->head);
+        size_t *len = (size_t *)(ln + sink->cnt + 1), i;
+        for (i = 0; i + 1 < sink->cnt; ++i)
+            len[i] = ln[i+1] - ln[i] - 1;
+        if (sink->cnt)
+            len[i] = buf + endOff - ln[i] - 1;
+    }
+    *length = d - buf;
+    return TRUE;
+}
+
+/*
+splitText turns the n chars at buf, as read in binary mode, into lines and
+stores their starts in sink, which sinkReserve has prepared.  buf[n] must be
+'\0'.  One Scan does everything readFile's text mode and the line split
+used to take three passes for, and scanFinish completes it.  buf is not
+shrunk by the carriage returns removed, so pointers into it remain valid.
+The text's new length is stored in *length.  splitText returns FALSE with
+errno set on failure; sink->a is then freed.
+*/
+static int
+splitText(char *buf, size_t n, LineSink *sink, size_t *length)
+{
+    Scan sc;
+
+    scanInit(&sc, buf, sink, NULL);
+    scanRun(&sc, buf + n, TRUE);
+    return scanFinish(&sc, length);
+}
+
+/*
+sizeBuffer makes *bufp, which holds *capacity chars and may be NULL, hold
+at least want chars.  If it doesn't, it is replaced by a larger buffer from
+allocator; its old contents are not kept.  The new buffer is exactly large
+enough if exact is TRUE, or else larger by at least half.  sizeBuffer
+returns TRUE on success or sets errno and returns FALSE.
+*/
+static int
+sizeBuffer(size_t want, int exact, const ReadFileAllocator *allocator,
+        char **bufp, size_t *capacity)
+{
+    if (!*bufp || want > *capacity) {
+        if (!want)
+            want = 1;
+        if (!exact && want < *capacity + *capacity / 2)
+            want = *capacity + *capacity / 2;
+        rfFree(allocator, *bufp);     // contents not needed
+        *bufp = rfAlloc(allocator, want);
+        *capacity = *bufp ? want : 0;
+        if (!*bufp)
+            return FALSE;
+        rfAdviseBuffer(*bufp, want, allocator);
+    }
+    return TRUE;
+}
+
+/*
+readSized reads the fsize chars of file in into *bufp, which holds
+*capacity chars and may be NULL, leaving room for t more chars.  If they
+don't fit then *bufp is replaced by a larger buffer from allocator; its old
+contents are not kept.  The new buffer is exactly large enough if exact is
+TRUE, or else larger by at least half.  The number of chars read, which is
+less than fsize if the file shrank, is stored in *length.  readSized returns
+TRUE on success or sets errno and returns FALSE.
+*/
+static int
+readSized(RfFile in, size_t fsize, size_t t, int exact,
+        const ReadFileAllocator *allocator, char **bufp, size_t *capacity,
+        size_t *length)
+{
+    if (!sizeBuffer(fsize + t, exact, allocator, bufp, capacity))
+        return FALSE;
+    rfAdviseFile(in, fsize);
+    return (*length = rfRead(in, *bufp, fsize)) != (size_t)-1;
+}
+
+#ifndef READFILE_NO_THREADS
+/*
+Files of at least PIPE_MIN chars that need a Scan are read PIPE_CHUNK chars
+at a time by readPipelined, on one reader thread per file, while the
+calling thread scans the chars already read, so the time taken is about
+the larger of the I/O and the scan instead of their sum.
+*/
+#define PIPE_CHUNK ((size_t)8 << 20)
+#define PIPE_MIN (2 * PIPE_CHUNK)
+
+/*
+A Pipe is a file being read by pipeRead into buf, on a thread of its own,
+while readPipelined scans it.  ready, done and error are shared, under
+lock; ready only grows, and wake is signaled each time it does.
+*/
+typedef struct Pipe {
+    RfFile in;
+    char *buf;
+    size_t fsize;
+    size_t ready;       // chars read so far
+    int done;           // TRUE once the reader has stopped
+    int error;          // errno if the read failed, or 0
+    #ifdef _MSC_VER
+      SRWLOCK lock;
+      CONDITION_VARIABLE wake;
+    #else
+      pthread_mutex_t lock;
+      pthread_cond_t wake;
+    #endif
+} Pipe;
+
+static void
+pipeLock(Pipe *p)
+{
+    #ifdef _MSC_VER
+      AcquireSRWLockExclusive(&p->lock);
+    #else
+      pthread_mutex_lock(&p->lock);
+    #endif
+}
+
+static void
+pipeUnlock(Pipe *p)
+{
+    #ifdef _MSC_VER
+      ReleaseSRWLockExclusive(&p->lock);
+    #else
+      pthread_mutex_unlock(&p->lock);
+    #endif
+}
+
+// pipeRead reads Pipe arg's file a chunk at a time, publishing each chunk.
+static void
+pipeRead(void *arg)
+{
+    Pipe *p = arg;
+    size_t off = 0, n, got;
+    int e = 0, done;
+
+    do {
+        n = p->fsize - off < PIPE_CHUNK ? p->fsize - off : PIPE_CHUNK;
+        if ((got = rfRead(p->in, p->buf + off, n)) == (size_t)-1) {
+            e = errno;
+            got = 0;
+        }
+        off += got;
+        done = e || got < n || off == p->fsize;   // a short read is the end
+        pipeLock(p);
+        p->ready = off;
+        p->error = e;
+        p->done = done;
+        #ifdef _MSC_VER
+          WakeConditionVariable(&p->wake);
+        #else
+          pthread_cond_signal(&p->wake);
+        #endif
+        pipeUnlock(p);
+    } while (!done);
+}
+
+/*
+readPipelined does what readSized does, and also applies Scan sc, whose
+text is *bufp, to the chars as they are read.  The scan is left to be
+finished with scanRun(sc, *bufp + *length, TRUE) once *bufp[*length] is
+'\0'.  If the reader thread can't be started the file is read first and
+scanned after.  readPipelined returns TRUE on success or sets errno and
+returns FALSE.
+*/
+static int
+readPipelined(RfFile in, size_t fsize, size_t t, int exact,
+        const ReadFileAllocator *allocator, char **bufp, size_t *capacity,
+        Scan *sc, size_t *length)
+{
+    Pipe p;
+    Task task;
+    size_t scanned = 0, ready;
+    int done;
+
+    if (!sizeBuffer(fsize + t, exact, allocator, bufp, capacity) ||
+            (sc->sink && !sinkReserve(sc->sink, fsize)))
+        return FALSE;
+    rfAdviseFile(in, fsize);
+    scanInit(sc, *bufp, sc->sink, sc->utf8);
+    memset(&p, 0, sizeof(p));
+    p.in = in;
+    p.buf = *bufp;
+    p.fsize = fsize;
+    #ifdef _MSC_VER
+      InitializeSRWLock(&p.lock);
+      InitializeConditionVariable(&p.wake);
+    #else
+      pthread_mutex_init(&p.lock, NULL);
+      pthread_cond_init(&p.wake, NULL);
+    #endif
+    memset(&task, 0, sizeof(task));
+    task.fn = pipeRead;
+    task.arg = &p;
+    startTask(&task);
+    if (!task.started)
+        pipeRead(&p);
+    do {
+        pipeLock(&p);
+        while (p.ready == scanned && !p.done) {
+            #ifdef _MSC_VER
+              SleepConditionVariableSRW(&p.wake, &p.lock, INFINITE, 0);
+            #else
+              pthread_cond_wait(&p.wake, &p.lock);
+            #endif
+        }
+        ready = p.ready;
+        done = p.done;
+        pipeUnlock(&p);
+        if (ready > scanned) {
+            scanRun(sc, *bufp + ready, FALSE);
+            scanned = ready;
+        }
+    } while (!done);
+    if (task.started)
+        joinTask(&task);
+    #ifndef _MSC_VER
+      pthread_cond_destroy(&p.wake);
+      pthread_mutex_destroy(&p.lock);
+    #endif
+    if (p.error) {
+        errno = p.error;
+        return FALSE;
+    }
+    *length = p.ready;
+    return TRUE;
+}
+#endif
+
+/*
+readStream reads file in, whose size is not known in advance, to its end
+into *bufp, which holds *capacity chars and may be NULL, leaving room for t
+more chars.  The buffer is doubled through allocator, keeping its contents,
+whenever it fills up, but never beyond maxSize chars if maxSize is
+non-zero.  If the data and t chars won't fit in maxSize chars, errno is set
+to EFBIG.  The number of chars read is stored in *length.  readStream
+returns TRUE on success or sets errno and returns FALSE.
+*/
+static int
+readStream(RfFile in, size_t t, size_t maxSize,
+        const ReadFileAllocator *allocator, char **bufp, size_t *capacity,
+        size_t *length)
+{
+    size_t n = 0, got, room;
+    char *b, probe;
+
+    for (;;) {
+        if (!*bufp || n + t >= *capacity) {
+            size_t want = *bufp && *capacity ? *capacity * 2 : 64 * 1024;
+            if (maxSize && want > maxSize)
+                want = maxSize;
+            if (*bufp && want <= *capacity) {   // at maxSize; any more data?
+                if ((got = rfRead(in, &probe, 1)) == (size_t)-1)
+                    return FALSE;
+                if (got || n + t > *capacity) {
+                    errno = EFBIG;
+                    return FALSE;
+                }
+                break;
+            }
+            b = *bufp ? rfRealloc(allocator, *bufp, *capacity, want) :
+                    rfAlloc(allocator, want);
+            if (!b)
+                return FALSE;
+            *bufp = b;
+            *capacity = want;
+            continue;
+        }
+        room = *capacity - t - n;
+        if ((got = rfRead(in, *bufp + n, room)) == (size_t)-1)
+            return FALSE;
+        n += got;
+        if (got < room)     // end of file
+            break;
+    }
+    *length = n;
+    return TRUE;
+}
+
+#if defined(READFILE_ZLIB) || defined(READFILE_ZSTD)
+/*
+If readFile.c is compiled with -DREADFILE_ZLIB or -DREADFILE_ZSTD, files
+that begin with a gzip or zstd magic number, respectively, are decompressed
+as they are read, INFLATE_CHUNK compressed chars at a time, straight into
+the buffer.  The buffer is sized once from the uncompressed size the file
+records, if it does, and doubled if the data outgrows it.
+*/
+#define READFILE_DECOMPRESS 1
+#define INFLATE_CHUNK ((size_t)1 << 20)
+
+enum { CODEC_NONE, CODEC_GZIP, CODEC_ZSTD };
+
+/*
+A file's recorded uncompressed size is trusted only up to CODEC_RATIO_MAX
+times its compressed size.  Deflate can't expand data by more than about
+1032:1, and zstd rarely does in practice; a crafted header can claim far
+more.  Data that outgrows a clamped hint is fitted by growOutput.
+*/
+#define CODEC_RATIO_MAX 1032
+
+/*
+rfCodec returns the codec that compressed the fsize chars of f, or
+CODEC_NONE, and stores in *hint the uncompressed size recorded in the
+file, at most CODEC_RATIO_MAX times fsize, or 0 if it isn't known.  gzip
+records the size modulo 2^32 of its last member, so the hint can be wrong
+for huge or concatenated files.
+*/
+static int
+rfCodec(RfFile f, size_t fsize, size_t *hint)
+{
+    unsigned char h[18];    // the longest zstd frame header
+    size_t got;
+    int codec = CODEC_NONE;
+
+    *hint = 0;
+    if ((got = rfReadAt(f, (char *)h, sizeof(h), 0)) == (size_t)-1 || got < 4)
+        return CODEC_NONE;
+    #ifdef READFILE_ZLIB
+      if (h[0] == 0x1f && h[1] == 0x8b && fsize >= 18) {
+          if (rfReadAt(f, (char *)h, 4, fsize - 4) == 4)
+              *hint = h[0] | (size_t)h[1] << 8 | (size_t)h[2] << 16 |
+                      (size_t)h[3] << 24;
+          codec = CODEC_GZIP;
+      }
+    #endif
+    #ifdef READFILE_ZSTD
+      if (h[0] == 0x28 && h[1] == 0xb5 && h[2] == 0x2f && h[3] == 0xfd) {
+          unsigned long long c = ZSTD_getFrameContentSize(h, got);
+          if (c != ZSTD_CONTENTSIZE_UNKNOWN && c != ZSTD_CONTENTSIZE_ERROR)
+              *hint = c < SIZE_MAX ? (size_t)c : SIZE_MAX;
+          codec = CODEC_ZSTD;
+      }
+    #endif
+    if (*hint / CODEC_RATIO_MAX >= fsize)
+        *hint = fsize * CODEC_RATIO_MAX;
+    return codec;
+}
+
+/*
+rfCodecByName returns the codec that compressed the file named fileName, or
+CODEC_NONE if it isn't compressed or can't be read, for the reads that open
+a file in a way rfCodec can't use.
+*/
+static int
+rfCodecByName(const char *fileName)
+{
+    RfFile f;
+    size_t fsize, hint;
+    int sized, codec = CODEC_NONE;
+
+    if ((f = rfOpen(fileName)) != RF_NO_FILE) {
+        if (rfSize(f, &fsize, &sized) && sized && fsize)
+            codec = rfCodec(f, fsize, &hint);
+        rfClose(f);
+    }
+    return codec;
+}
+
+/*
+growOutput doubles *bufp, which holds *capacity chars, through allocator,
+keeping its contents, but not beyond maxSize chars if maxSize is non-zero.
+growOutput returns FALSE with errno set to EFBIG if the buffer is already
+that large, or to ENOMEM if memory is exhausted.
+*/
+static int
+growOutput(size_t maxSize, const ReadFileAllocator *allocator, char **bufp,
+        size_t *capacity)
+{
+    size_t want = *capacity <= SIZE_MAX / 2 ? *capacity * 2 : SIZE_MAX;
+    char *b;
+
+    if (maxSize && want > maxSize)
+        want = maxSize;
+    if (want <= *capacity) {
+        errno = EFBIG;
+        return FALSE;
+    }
+    if (!(b = rfRealloc(allocator, *bufp, *capacity, want)))
+        return FALSE;
+    *bufp = b;
+    *capacity = want;
+    return TRUE;
+}
+
+/*
+readCompressed decompresses the fsize chars of file in, compressed by
+codec, into *bufp as readSized reads them, first sizing the buffer for hint
+chars if hint is non-zero.  The data and t more chars must fit in maxSize
+chars if maxSize is non-zero, or errno is set to EFBIG.  Invalid or
+truncated data sets errno to EILSEQ.  The number of chars decompressed is
+stored in *length.  readCompressed returns TRUE on success or sets errno
+and returns FALSE.
+*/
+static int
+readCompressed(RfFile in, size_t fsize, int codec, size_t hint, size_t t,
+        size_t maxSize, int exact, const ReadFileAllocator *allocator,
+        char **bufp, size_t *capacity, size_t *length)
+{
+    size_t want = hint ? hint : fsize < SIZE_MAX / 4 ? fsize * 4 : fsize;
+    size_t off = 0;         // offset of the next compressed chars
+    size_t n = 0;           // chars decompressed
+    size_t got, before;
+    int last;               // TRUE once all the compressed chars are in
+    int ok;
+    char *inBuf;
+
+    if (want < SIZE_MAX - t)
+        want += t;
+    if (maxSize && want > maxSize)
+        want = maxSize;
+    if (!sizeBuffer(want, exact, allocator, bufp, capacity))
+        return FALSE;
+    if (!(inBuf = malloc(INFLATE_CHUNK))) {
+        errno = ENOMEM;
+        return FALSE;
+    }
+    rfAdviseFile(in, fsize);
+    ok = TRUE;
+
+    #ifdef READFILE_ZLIB
+    if (codec == CODEC_GZIP) {
+        z_stream zs;
+        int ret, ended = FALSE;
+
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {  // gzip only
+            errno = ENOMEM;
+            ok = FALSE;
+        }
+        while (ok) {
+            if (!zs.avail_in && off < fsize) {
+                if ((got = rfReadAt(in, inBuf, INFLATE_CHUNK, off)) ==
+                        (size_t)-1) {
+                    ok = FALSE;
+                    break;
+                }
+                if (!got)
+                    fsize = off;    // the file shrank
+                off += got;
+                zs.next_in = (Bytef *)inBuf;
+                zs.avail_in = (uInt)got;
+            }
+            last = !zs.avail_in && off >= fsize;
+            if (ended && (last || zs.next_in[0] != 0x1f))
+                break;      // done, ignoring any padding after the last member
+            if (ended) {
+                inflateReset(&zs);  // another member follows
+                ended = FALSE;
+            }
+            if (n + t == *capacity &&
+                    !(ok = growOutput(maxSize, allocator, bufp, capacity)))
+                break;
+            got = *capacity - t - n;
+            zs.next_out = (Bytef *)*bufp + n;
+            zs.avail_out = got < ((size_t)1 << 30) ? (uInt)got : 1u << 30;
+            before = n;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            n = (char *)zs.next_out - *bufp;
+            if (ret == Z_STREAM_END) {
+                ended = TRUE;
+            } else if (ret == Z_MEM_ERROR) {
+                errno = ENOMEM;
+                ok = FALSE;
+            } else if ((ret != Z_OK && ret != Z_BUF_ERROR) ||
+                    (last && n == before)) {
+                errno = EILSEQ;
+                ok = FALSE;
+            }
+        }
+        inflateEnd(&zs);
+    }
+    #endif
+    #ifdef READFILE_ZSTD
+    if (codec == CODEC_ZSTD) {
+        ZSTD_DStream *ds = ZSTD_createDStream();
+        ZSTD_inBuffer zin;
+        ZSTD_outBuffer zout;
+        size_t ret = 1;     // 0 once a frame is complete
+
+        zin.src = inBuf;
+        zin.size = zin.pos = 0;
+        if (!ds || ZSTD_isError(ZSTD_initDStream(ds))) {
+            errno = ENOMEM;
+            ok = FALSE;
+        }
+        while (ok) {
+            if (zin.pos == zin.size && off < fsize) {
+                if ((got = rfReadAt(in, inBuf, INFLATE_CHUNK, off)) ==
+                        (size_t)-1) {
+                    ok = FALSE;
+                    break;
+                }
+                if (!got)
+                    fsize = off;    // the file shrank
+                off += got;
+                zin.size = got;
+                zin.pos = 0;
+            }
+            last = zin.pos == zin.size && off >= fsize;
+            if (last && !ret)
+                break;
+            if (n + t == *capacity &&
+                    !(ok = growOutput(maxSize, allocator, bufp, capacity)))
+                break;
+            zout.dst = *bufp;
+            zout.size = *capacity - t;
+            zout.pos = before = n;
+            ret = ZSTD_decompressStream(ds, &zout, &zin);
+            n = zout.pos;
+            if (ZSTD_isError(ret) || (last && n == before)) {
+                errno = EILSEQ;
+                ok = FALSE;
+            }
+        }
+        ZSTD_freeDStream(ds);
+    }
+    #endif
+    free(inBuf);
+    *length = n;
+    return ok;
+}
+#endif
+
+// failStatus returns the ReadFileStatus for the errno a failed read step
+// has just set.
+static ReadFileStatus
+failStatus(void)
+{
+    return errno == ENOMEM ? READFILE_NO_MEMORY :
+        errno == EFBIG ? READFILE_TOO_BIG : READFILE_READ_FAILED;
+}
+
+// gotData returns TRUE if a call ending with status st returns data.
+static int
+gotData(ReadFileStatus st)
+{
+    return st == READFILE_OK || st == READFILE_SHORT_READ;
+}
+
+/*
+READFILE_MIN_SLACK is the smallest share of a buffer, in percent, that must
+be unused before the buffer is reallocated to fit its data.  Text mode
+usually removes only a few percent of a file's chars, and reallocating to
+free so little can cost a full copy with some allocators (an arena's
+reallocate, for one).  glibc already shrinks large blocks in place with
+mremap.  Compile with -DREADFILE_MIN_SLACK=0 to always shrink, or with a
+value over 100 to never shrink.
+*/
+#ifndef READFILE_MIN_SLACK
+	#define READFILE_MIN_SLACK 5
+#endif
+
+// worthShrinking returns TRUE if a buffer of capacity chars holding fit
+// chars has enough slack to be reallocated.
+static int
+worthShrinking(size_t capacity, size_t fit)
+{
+    return fit < capacity &&
+        capacity - fit >= capacity / 100 * READFILE_MIN_SLACK +
+            capacity % 100 * READFILE_MIN_SLACK / 100;
+}
+
+/*
+readFileBuf reads the file named fileName as readFileEx does, into *bufp,
+which holds *capacity chars and may be NULL.  A fileName of "-" means the
+standard input.  A file whose size can be known in advance is read by
+readSized; a pipe, a terminal, or a file reporting size 0 (as files in
+/proc do) is read by readStream.  If shrink is TRUE the buffer is
+reallocated to fit the data when done, if worthShrinking says that it has
+enough slack.  If shrink is FALSE the buffer is never shrunk, and it grows
+by at least half when it must grow.  *capacity is kept up to date.  If sink
+is not NULL then the text is split into lines in sink, which sinkInit has
+prepared, as splitText does; the buffer is then not shrunk.  If utf8 is
+not NULL then a Scan with utf8 checks the text for readFileUtf8 instead;
+terminate must then be TRUE.  Large files that need text mode, a split or
+a check are read by readPipelined, so their scan overlaps their I/O.  If
+stats is not NULL then the phases are timed and counted in *stats; a
+pipelined scan is timed as part of the read.
+readFileBuf returns a ReadFileStatus, and sets errno too if it's not
+READFILE_OK; *bufp is the caller's to free either way.
+*/
+static ReadFileStatus
+readFileBuf(const char *fileName, int textMode, int terminate, size_t maxSize,
+		int shrink, const ReadFileAllocator *allocator, char **bufp,
+		size_t *capacity, size_t *length, ReadFileStats *stats,
+		LineSink *sink, Utf8Scan *utf8)
+{
+	RfFile in;			// input file
+	size_t fsize;		// file size, if known in advance
+	size_t n = 0;		// length in chars of the data as read from the file
+	char *buf;			// points to retrieved data
+    size_t t;           // space for terminating '\0'
+    size_t fit;         // chars needed for the data
+    int sized;          // TRUE if fsize is known in advance
+    int isStdin;        // TRUE if fileName is "-"
+    int shortRead = FALSE;  // TRUE if the file shrank while it was read
+    ReadFileStatus st = READFILE_BAD_ARGUMENT;
+    int scanned = FALSE;    // TRUE if sc has scanned the text as it was read
+    Scan sc;
+    uint64_t mark = 0;  // start of the current phase, if stats
+#ifdef READFILE_DECOMPRESS
+    int codec;          // how the file is compressed
+    size_t hint;        // its uncompressed size, if recorded
+#endif
+
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        mark = rfNow();
+    }
+	if (!fileName) {
+		errno = EINVAL;
+	} else {
+        if (textMode)
+            terminate = TRUE;
+		t = !!terminate;	// allowance for terminator if required
+        isStdin = !strcmp(fileName, "-");
+        st = READFILE_OPEN_FAILED;
+		if ((in = isStdin ? rfStdin() : rfOpen(fileName)) != RF_NO_FILE) {
+			if (!rfSize(in, &fsize, &sized)) {
+                if (errno == EFBIG)
+                    st = READFILE_TOO_BIG;
+            } else {
+                st = READFILE_OK;
+                if (stats)
+                    stats->openNs = rfLap(&mark);
+#ifdef READFILE_DECOMPRESS
+				if (sized && fsize &&
+                        (codec = rfCodec(in, fsize, &hint)) != CODEC_NONE) {
+                    if (!readCompressed(in, fsize, codec, hint, t, maxSize,
+                            shrink, allocator, bufp, capacity, &n))
+                        st = failStatus();
+                } else
+#endif
+				if (sized && fsize) {
+                    if (maxSize && (fsize + t) > maxSize) {
+                        errno = EFBIG;
+                        st = READFILE_TOO_BIG;
+#ifndef READFILE_NO_THREADS
+                    } else if (fsize >= PIPE_MIN &&
+                            (textMode || sink || utf8)) {
+                        sc.sink = sink;
+                        sc.utf8 = utf8;
+                        if (!readPipelined(in, fsize, t, shrink, allocator,
+                                bufp, capacity, &sc, &n))
+                            st = failStatus();
+                        scanned = TRUE;
+#endif
+                    } else if (!readSized(in, fsize, t, shrink, allocator,
+                            bufp, capacity, &n)) {
+                        st = failStatus();
+                    }
+                    shortRead = n < fsize;
+                } else if (!readStream(in, t, maxSize, allocator, bufp,
+                        capacity, &n)) {
+                    st = failStatus();
+                }
+                if (stats)
+                    stats->readNs = rfLap(&mark);
+                if (st == READFILE_OK) {
+                    buf = *bufp;
+                    if (stats)
+                        stats->bytesRead = n;
+                    if (terminate)
+                        buf[n] = '\0';  // for the scan below
+                    if (scanned) {
+                        scanRun(&sc, buf + n, TRUE);
+                        if (!sink)
+                            buf[n = sc.d - buf] = '\0';
+                        else if (!scanFinish(&sc, &n))
+                            st = failStatus();
+                    } else if (sink) {
+                        if (!sinkReserve(sink, n) ||
+                                !splitText(buf, n, sink, &n))
+                            st = failStatus();
+                    } else if (utf8) {
+                        scanInit(&sc, buf, NULL, utf8);
+                        scanRun(&sc, buf + n, TRUE);
+                        buf[n = sc.d - buf] = '\0';
+                    } else if (textMode) {
+                        n = removeCRLF(buf, n, NULL);
+                        buf[n] = '\0';
+                    }
+                    if (stats && st == READFILE_OK && (textMode || sink)) {
+                        *(sink ? &stats->splitNs : &stats->crlfNs) =
+                            rfLap(&mark);
+                        stats->crsRemoved = stats->bytesRead - n;
+                        stats->lines = sink ? sink->cnt : 0;
+                    }
+                    fit = n + t ? n + t : 1;
+                    if (st == READFILE_OK && !sink && shrink &&
+                            worthShrinking(*capacity, fit)) {
+                        char *b = rfRealloc(allocator, buf, *capacity, fit);
+                        if (b) {
+                            *bufp = b;
+                            *capacity = fit;
+                            if (stats)
+                                stats->shrunk = TRUE;
+                        } else
+                            errno = 0; // let original buf be returned
+                    }
+                    if (st == READFILE_OK && shortRead)
+                        st = READFILE_SHORT_READ;
+                    if (stats)
+                        stats->shrinkNs = rfLap(&mark);
+				}
+			}
+            if (!isStdin)
+                rfClose(in);
+            if (stats)
+                stats->openNs += rfLap(&mark);  // closing
+		}
+	}
+
+	*length = gotData(st) ? n : 0;
+
+	return st;
+}
+
+/*
+readFile reads the entire contents of the file named "fileName" into a
+newly-malloc'ed buffer and returns a pointer to the buffer.  A file of
+16 MB or more read in text mode (or by readLines) is read on a second
+thread while the calling thread removes its carriage returns, so link with
+-pthread on POSIX systems, or compile readFile.c with -DREADFILE_NO_THREADS
+to read every file on the calling thread.  Include readFile.h before
+calling readFile.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the file to read, or "-" for the standard input.
+                Pipes and other files whose size is not known in advance
+                are read to their end into a growing buffer.
+	textMode    Read in text mode if non-zero, or in binary mode if zero.
+                If textMode is non-zero then "\r\n" is replaced by "\n" and
+                terminate is forced to TRUE.
+	terminate   If terminate is non-zero then a terminating '\0' is added after
+				the end of the file's contents in the buffer.
+	maxSize		If maxSize is non-zero its value sets a limit on the 
+				returned buffer size, measured in chars.  If maxSize is
+				non-zero and inadequate then errno is set to EFBIG and NULL
+				is returned.  If maxSize is zero then there is no limit.
+  Outputs:	
+	length      if length is non-NULL then the length of the data in chars
+				(excluding any added terminating '\0') is stored in *length.
+RETURN VALUE
+------------
+readFile returns a pointer to a newly malloc'ed data buffer or, if an error
+occurs, it sets errno and returns NULL.  The caller should free the returned
+buffer when it is no longer needed, even if *length is 0.
+*/
+char *
+readFile(const char *fileName, int textMode, int terminate, size_t maxSize,
+		size_t *length)
+{
+    return readFileEx(fileName, textMode, terminate, maxSize, length, NULL);
+}
+
+// readFileAlloc does what readFileEx does and, if stats is not NULL, what
+// readFileWithStats does.  If status is not NULL then the ReadFileStatus is
+// stored in *status.
+static char *
+readFileAlloc(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length, const ReadFileAllocator *allocator,
+		ReadFileStats *stats, ReadFileStatus *status)
+{
+	char *buf = NULL;	// points to retrieved data
+	size_t cap = 0;		// size of buf
+	size_t n = 0;		// length in chars of the data
+	ReadFileStatus st;
+
+	st = readFileBuf(fileName, textMode, terminate, maxSize, TRUE, allocator,
+			&buf, &cap, &n, stats, NULL, NULL);
+	if (status)
+		*status = st;
+	if (!gotData(st)) {
+		n = 0;
+		rfFree(allocator, buf);
+		buf = NULL;
+	}
+
+	if (length)
+		*length = n;
+
+	return buf;
+}
+
+/*
+readFileEx does what readFile does, but gets the buffer from allocator
+instead of malloc.  allocator's allocate, reallocate and deallocate
+functions are each passed allocator's context; reallocate is also passed
+the old size.  They may, for example, carve the memory from a per-request
+arena and ignore deallocate.  If allocator is NULL then malloc, realloc and
+free are used.  The caller should release the returned buffer through
+allocator when it is no longer needed, even if *length is 0.
+*/
+char *
+readFileEx(const char *fileName, int textMode, int terminate, size_t maxSize,
+		size_t *length, const ReadFileAllocator *allocator)
+{
+	return readFileAlloc(fileName, textMode, terminate, maxSize, length,
+			allocator, NULL, NULL);
+}
+
+/*
+readFileStatusEx does what readFileEx does, but returns a ReadFileStatus
+telling what happened, so callers need not sort out errno.  The buffer is
+stored in *buf and its length in *length; both are NULL and 0 unless
+READFILE_OK or READFILE_SHORT_READ is returned.  READFILE_SHORT_READ means
+the file shrank while it was read, so only its first *length chars were
+read.  Include readFile.h before calling readFileStatusEx.
+ARGUMENTS
+---------
+  Inputs:
+	fileName	as for readFile
+	textMode	as for readFile
+	terminate	as for readFile
+	maxSize		as for readFile
+	allocator	as for readFileEx
+  Outputs:
+	buf			receives the buffer, or NULL
+	length		receives the length of the data in chars, or 0; may be NULL
+RETURN VALUE
+------------
+readFileStatusEx returns a ReadFileStatus.
+*/
+ReadFileStatus
+readFileStatusEx(const char *fileName, int textMode, int terminate,
+		size_t maxSize, const ReadFileAllocator *allocator, char **buf,
+		size_t *length)
+{
+	ReadFileStatus st;
+
+	*buf = readFileAlloc(fileName, textMode, terminate, maxSize, length,
+			allocator, NULL, &st);
+
+	return st;
+}
+
+/*
+readFileStatusString returns a short English description of status.
+*/
+const char *
+readFileStatusString(ReadFileStatus status)
+{
+	switch (status) {
+	case READFILE_OK:			return "success";
+	case READFILE_SHORT_READ:	return "file shrank while being read";
+	case READFILE_BAD_ARGUMENT:	return "invalid argument";
+	case READFILE_OPEN_FAILED:	return "file could not be opened";
+	case READFILE_TOO_BIG:		return "file too big";
+	case READFILE_READ_FAILED:	return "read failed";
+	case READFILE_NO_MEMORY:	return "out of memory";
+	}
+
+	return "unknown status";
+}
+
+/*
+readFileWithStats does what readFile does, and also stores in *stats how
+long each phase took and what it did.  Include readFile.h before calling
+readFileWithStats.  stats may be NULL.
+ARGUMENTS
+---------
+  Inputs:
+	fileName, textMode, terminate and maxSize are as for readFile.
+  Outputs:
+	length      as for readFile
+	stats		if stats is non-NULL then *stats is filled in as follows,
+				even if an error occurs:
+				openNs		nanoseconds spent opening, sizing and closing
+							the file
+				readNs		nanoseconds spent allocating and reading
+				crlfNs		nanoseconds spent removing carriage returns
+				splitNs		0
+				shrinkNs	nanoseconds spent reallocating the buffer to
+							fit the data
+				bytesRead	the number of chars read from the file
+				crsRemoved	the number of carriage returns removed
+				lines		0
+				shrunk		TRUE if the buffer was reallocated to fit
+RETURN VALUE
+------------
+readFileWithStats returns the same as readFile.
+*/
+char *
+readFileWithStats(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length, ReadFileStats *stats)
+{
+	return readFileAlloc(fileName, textMode, terminate, maxSize, length, NULL,
+			stats, NULL);
+}
+
+/*
+readFileInto reads the entire contents of the file named fileName into the
+caller's buffer *buf, which holds *capacity chars, and returns a pointer to
+the buffer.  The buffer is reallocated, and *buf and *capacity updated,
+only if the file doesn't fit; it is never shrunk.  Reading similarly sized
+files into the same buffer therefore settles into no allocation at all.
+textMode and terminate are as for readFile.  Include readFile.h before
+calling readFileInto.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the file to read
+	textMode    as for readFile
+	terminate   as for readFile
+  Inputs and Outputs:
+	buf			a pointer to the buffer pointer.  *buf may be NULL (with
+				*capacity 0) to have readFileInto allocate the buffer.
+	capacity	a pointer to the size of *buf in chars
+  Outputs:
+	length      if length is non-NULL then the length of the data in chars
+				(excluding any added terminating '\0') is stored in *length.
+RETURN VALUE
+------------
+readFileInto returns *buf or, if an error occurs, it sets errno and returns
+NULL.  Either way *buf, if not NULL, remains the caller's to free with free
+when it is no longer needed.
+*/
+char *
+readFileInto(const char *fileName, int textMode, int terminate, char **buf,
+		size_t *capacity, size_t *length)
+{
+	size_t n = 0;		// length in chars of the data
+	char *p = NULL;
+
+	if (!buf || !capacity)
+		errno = EINVAL;
+	else if (gotData(readFileBuf(fileName, textMode, terminate, 0, FALSE,
+			NULL, buf, capacity, &n, NULL, NULL, NULL)))
+		p = *buf;
+
+	if (length)
+		*length = p ? n : 0;
+
+	return p;
+}
+
+/*
+readFileUtf8 does what readFile does, and also removes a leading UTF-8 byte
+order mark and checks that the text is valid UTF-8, in the same pass that
+removes carriage returns in text mode (or in one pass of its own in binary
+mode).  The text is returned even if it isn't valid.  It is checked a
+vector at a time, multi-byte sequences included, by lookup tables as
+utf8Check describes, and a file of 16 MB or more is checked on the calling
+thread while a second thread reads it, as in readFile's text mode.
+Include readFile.h before calling readFileUtf8.
+ARGUMENTS
+---------
+  Inputs:
+	fileName, textMode, terminate and maxSize are as for readFile.
+  Outputs:
+	length			as for readFile
+	invalidOffset	if invalidOffset is non-NULL then the offset in the
+					returned text of the first char that isn't part of a
+					valid UTF-8 sequence, or (size_t)-1 if all are, is stored
+					in *invalidOffset.
+RETURN VALUE
+------------
+readFileUtf8 returns the same as readFile.
+*/
+char *
+readFileUtf8(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length, size_t *invalidOffset)
+{
+	char *buf = NULL;	// points to retrieved data
+	size_t cap = 0;		// size of buf
+	size_t n = 0;		// length in chars of the data
+	Utf8Scan u;			// the check, with the first invalid char's offset
+
+	(void)terminate;	// the text is always terminated
+	u.crlf = !!textMode;
+	u.invalid = (size_t)-1;
+	if (!gotData(readFileBuf(fileName, FALSE, TRUE, maxSize, TRUE, NULL,
+			&buf, &cap, &n, NULL, NULL, &u))) {
+		free(buf);
+		buf = NULL;
+		n = 0;
+		u.invalid = (size_t)-1;
+	}
+	if (length)
+		*length = n;
+	if (invalidOffset)
+		*invalidOffset = u.invalid;
+
+	return buf;
+}
+
+/*
+readFileDirect reads with direct I/O, DIRECT_CHUNK chars at a time, at
+offsets and in sizes that are multiples of DIRECT_ALIGN, which suits the
+sector and page sizes of current disks and file systems.
+*/
+#define DIRECT_ALIGN ((size_t)4096)
+#define DIRECT_CHUNK ((size_t)16 << 20)
+
+/*
+readDirect reads the fsize chars of file in, opened for direct I/O, into a
+new buffer with room for t more chars, stores the buffer's address in
+*bufp and the number of chars read in *length.  It returns TRUE on success
+or sets errno and returns FALSE; *bufp is then NULL or the caller's to
+free.  errno is EINVAL if the file system rejects direct reads of this
+alignment and they can't be turned off midway (on Windows, whose handle
+can't drop FILE_FLAG_NO_BUFFERING), so the caller should read the file
+buffered instead.  On POSIX the data is read straight into a buffer
+aligned for direct I/O; posix_memalign's memory may be passed to free.
+Windows' aligned memory may not, so there the data is read into an aligned
+window and copied to a malloc'ed buffer.
+*/
+static int
+readDirect(RfFile in, size_t fsize, size_t t, char **bufp, size_t *length)
+{
+    size_t span = (fsize + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+    size_t off = 0, want;
+
+    #ifdef _MSC_VER
+      DWORD got;
+      char *window;
+      (void)span;
+      if (!(*bufp = malloc(fsize + t)))
+          return FALSE;
+      if (!(window = VirtualAlloc(NULL, DIRECT_CHUNK, MEM_COMMIT | MEM_RESERVE,
+              PAGE_READWRITE))) {
+          setErrnoWin();
+          return FALSE;
+      }
+      while (off < fsize) {
+          if (!ReadFile(in, window, (DWORD)DIRECT_CHUNK, &got, NULL)) {
+              if (GetLastError() == ERROR_INVALID_PARAMETER)
+                  errno = EINVAL;   // not aligned as this volume wants
+              else
+                  setErrnoWin();
+              VirtualFree(window, 0, MEM_RELEASE);
+              return FALSE;
+          }
+          if (!got)
+              break;
+          want = got < fsize - off ? got : fsize - off;
+          memcpy(*bufp + off, window, want);
+          off += want;
+      }
+      VirtualFree(window, 0, MEM_RELEASE);
+    #else
+      ssize_t got;
+      void *p;
+      int e;
+      if ((e = posix_memalign(&p, DIRECT_ALIGN, span > fsize + t ? span :
+              fsize + t))) {
+          *bufp = NULL;
+          errno = e;
+          return FALSE;
+      }
+      *bufp = p;
+      rfAdviseBuffer(p, fsize + t, NULL);
+      while (off < span) {
+          want = span - off < DIRECT_CHUNK ? span - off : DIRECT_CHUNK;
+          if ((got = read(in, *bufp + off, want)) > 0) {
+              off += got;
+          } else if (!got) {
+              break;
+          } else if (errno == EINVAL) {
+              #ifdef O_DIRECT
+                // Not aligned as this file system wants; finish buffered.
+                int flags = fcntl(in, F_GETFL);
+                if (flags < 0 || !(flags & O_DIRECT) ||
+                        fcntl(in, F_SETFL, flags & ~O_DIRECT) < 0)
+                    return FALSE;
+              #else
+                return FALSE;
+              #endif
+          } else if (errno != EINTR) {
+              return FALSE;
+          }
+      }
+    #endif
+    *length = off < fsize ? off : fsize;  // ignore any growth since rfSize
+    return TRUE;
+}
+
+// rfOpenDirect opens fileName for reading with direct I/O, or sets errno
+// and returns RF_NO_FILE.  errno is EINVAL if the file system doesn't
+// support direct I/O.
+static RfFile
+rfOpenDirect(const char *fileName)
+{
+    RfFile f;
+
+    #ifdef _MSC_VER
+      f = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ |
+              FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING |
+              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (f == RF_NO_FILE)
+          setErrnoWin();
+    #elif defined(O_DIRECT)
+      do
+          f = open(fileName, O_RDONLY | O_DIRECT);
+      while (f < 0 && errno == EINTR);
+    #else
+      f = rfOpen(fileName);
+      #ifdef F_NOCACHE
+        if (f != RF_NO_FILE)
+            fcntl(f, F_NOCACHE, 1);
+      #endif
+    #endif
+    return f;
+}
+
+/*
+readFileDirect does what readFile does, but with direct I/O, which moves
+the data from the disk to the buffer without keeping it in the OS's page
+cache.  A huge file read once then doesn't push other programs' data out
+of memory, and on fast SSDs the read is often faster too.  Direct I/O uses
+O_DIRECT on Linux and other systems that have it, F_NOCACHE on macOS and
+FILE_FLAG_NO_BUFFERING on Windows.  Files for which direct I/O is not
+available (on tmpfs, for one, or on a volume that rejects its alignment),
+pipes, the standard input ("-"), empty files and, if readFile.c is compiled
+to decompress them, compressed files are read as readFile reads them.
+Include readFile.h before calling readFileDirect.
+ARGUMENTS
+---------
+  Inputs:
+	fileName, textMode, terminate and maxSize are as for readFile.
+  Outputs:
+	length      as for readFile
+RETURN VALUE
+------------
+readFileDirect returns the same as readFile.  The buffer may be passed to
+free.
+*/
+char *
+readFileDirect(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length)
+{
+	RfFile in;			// input file
+	size_t fsize;		// file size
+	size_t n = 0;		// length in chars of the data
+	size_t t;			// space for terminating '\0'
+	char *buf = NULL;	// points to retrieved data
+	int sized;			// TRUE if fsize is known in advance
+	int buffered = FALSE;	// TRUE to read as readFile does instead
+
+	if (!fileName || !strcmp(fileName, "-"))
+		return readFile(fileName, textMode, terminate, maxSize, length);
+#ifdef READFILE_DECOMPRESS
+	if (rfCodecByName(fileName) != CODEC_NONE)	// decompress as readFile does
+		return readFile(fileName, textMode, terminate, maxSize, length);
+#endif
+	if (textMode)
+		terminate = TRUE;
+	t = !!terminate;	// allowance for terminator if required
+
+	if ((in = rfOpenDirect(fileName)) == RF_NO_FILE) {
+		buffered = errno == EINVAL;	// no direct I/O on this file system
+	} else {
+		if (rfSize(in, &fsize, &sized)) {
+			if (!sized || !fsize) {
+				buffered = TRUE;
+			} else if (maxSize && fsize + t > maxSize) {
+				errno = EFBIG;
+			} else if (readDirect(in, fsize, t, &buf, &n)) {
+				if (terminate)
+					buf[n] = '\0';	// for removeCRLF below
+				if (textMode) {
+					n = removeCRLF(buf, n, NULL);
+					buf[n] = '\0';
+				}
+			} else {
+				buffered = errno == EINVAL;	// direct reads rejected
+				free(buf);
+				buf = NULL;
+			}
+		}
+		rfClose(in);
+	}
+
+	if (buffered)
+		return readFile(fileName, textMode, terminate, maxSize, length);
+	if (length)
+		*length = buf ? n : 0;
+
+	return buf;
+}
+
+// rfOpenRange opens fileName for reads at any offset and stores its size in
+// *size, or sets errno and returns RF_NO_FILE.
+static RfFile
+rfOpenRange(const char *fileName, size_t *size)
+{
+	RfFile in = RF_NO_FILE;
+	int sized;
+
+	if (!fileName) {
+		errno = EINVAL;
+	} else if ((in = rfOpen(fileName)) != RF_NO_FILE) {
+		if (rfSize(in, size, &sized) && !sized)
+			errno = ESPIPE;		// a pipe or the like can't be read at offset
+		if (!sized) {
+			rfClose(in);
+			in = RF_NO_FILE;
+		}
+	}
+	return in;
+}
+
+/*
+readFileRange reads the length chars of the file named fileName starting
+at offset, as readFile would read them from the whole file, into a
+newly-malloc'ed buffer.  Nothing before offset is read, so processes or
+machines can share out a huge file by byte range and each read only its
+own slice.  The range is cut short at the end of the file; an offset at or
+past the end gives an empty buffer.  In text mode a "\r\n" split by the
+range's end loses its '\r', so the ranges' texts put together equal the
+whole file's.  The file must be a regular file or a disk; pipes and the
+standard input can't be read at an offset.  The range indexes the chars
+stored in the file, so a compressed file's range is returned compressed
+even if readFile.c is compiled to decompress files.  Include readFile.h
+before calling readFileRange.
+ARGUMENTS
+---------
+  Inputs:
+	fileName	the name of the file to read
+	offset		the offset in chars of the first char to read
+	length		the most chars to read; SIZE_MAX reads to the end of the file
+	textMode	as for readFile
+	terminate	as for readFile
+  Outputs:
+	outLen		receives the length of the data in chars; may be NULL
+RETURN VALUE
+------------
+readFileRange returns a pointer to the buffer, which may be passed to free,
+or NULL with errno set if an error occurs.
+*/
+char *
+readFileRange(const char *fileName, size_t offset, size_t length,
+		int textMode, int terminate, size_t *outLen)
+{
+	RfFile in;			// input file
+	size_t fsize;		// file size
+	size_t n = 0;		// length in chars of the data
+	size_t want = 0;	// chars to read: the range and one char after it
+	size_t got;			// chars read
+	char *buf = NULL;	// points to retrieved data
+	char *b;
+
+	if ((in = rfOpenRange(fileName, &fsize)) != RF_NO_FILE) {
+		if (offset < fsize) {
+			n = fsize - offset < length ? fsize - offset : length;
+			want = n + (n < fsize - offset);  // the char after tells of "\r\n"
+		}
+		if (!(buf = malloc(want + 1))) {
+			errno = ENOMEM;
+		} else if ((got = rfReadAt(in, buf, want, offset)) == (size_t)-1) {
+			free(buf);
+			buf = NULL;
+		} else {
+			if (got < n)
+				n = got;	// the file shrank
+			buf[got] = '\0';	// for removeCRLF below
+			if (textMode)
+				n = removeCRLF(buf, n, NULL);
+			if (textMode || terminate)
+				buf[n] = '\0';
+			if (worthShrinking(want + 1, n + 1) && (b = realloc(buf, n + 1)))
+				buf = b;
+		}
+		rfClose(in);
+	}
+	if (outLen)
+		*outLen = buf ? n : 0;
+
+	return buf;
+}
+
+/*
+readLinesRange reads lines from the text file named fileName as readLines
+does, but only the lines that start in the length chars at offset.  The
+first line is the one starting at offset, if a line does, or else the one
+after the next linefeed; the last line is read to its end even if that is
+past the range.  A file shared out in ranges thus yields each of its lines
+from exactly one range, and the ranges' lines put together equal the lines
+readLines returns.  As for readFileRange, nothing before offset (but the
+char just before it) is read, the file can't be a pipe, and a compressed
+file is not decompressed.  Free the lines with freeLines.  Include
+readFile.h before calling readLinesRange.
+ARGUMENTS
+---------
+  Inputs:
+	fileName	the name of the file to read
+	offset		the offset in chars at which the range begins
+	length		the size of the range in chars; SIZE_MAX means to the end of
+				the file
+	maxSize		as for readLines
+  Outputs:
+	lineCount	receives the number of lines; may be NULL
+RETURN VALUE
+------------
+readLinesRange returns the same as readLines.
+*/
+char **
+readLinesRange(const char *fileName, size_t offset, size_t length,
+		size_t maxSize, size_t *lineCount)
+{
+	RfFile in;			// input file
+	size_t fsize;		// file size
+	size_t start, end;	// the part of the file to read first
+	size_t got = 0;		// chars read
+	size_t skip = 0;	// chars before the first line in the range
+	size_t cap;			// size of buf
+	size_t k;
+	size_t n;			// length of the text after the split
+	char *buf = NULL;	// points to retrieved text
+	char **lines = NULL;	// argv-like array of lines found
+	char *b, *p;
+	int ok;
+	LineSink sink;
+
+	if ((in = rfOpenRange(fileName, &fsize)) != RF_NO_FILE) {
+		end = offset < fsize ? (fsize - offset < length ? fsize :
+				offset + length) : fsize;
+		start = offset ? offset - 1 : 0;	// the char before tells of a line
+		if (start > end)
+			start = end;
+		cap = end - start + 1;
+		if (maxSize && cap > maxSize) {
+			errno = EFBIG;
+			ok = FALSE;
+		} else if (!(buf = malloc(cap))) {
+			errno = ENOMEM;
+			ok = FALSE;
+		} else {
+			ok = (got = rfReadAt(in, buf, end - start, start)) != (size_t)-1;
+		}
+		if (ok && offset) {
+			p = memchr(buf, '\n', got);
+			skip = p ? (size_t)(p - buf) + 1 : got;
+		}
+
+		// Read past end to the end of the last line, if it's in the range.
+		if (ok && skip < got && buf[got-1] != '\n' && got == end - start) {
+			for (;;) {
+				if (got + 1 == cap) {
+					k = cap < ((size_t)64 << 10) ? (size_t)64 << 10 : cap;
+					if (maxSize && k > maxSize - cap)
+						k = maxSize - cap;
+					if (!k) {
+						errno = EFBIG;
+						ok = FALSE;
+						break;
+					}
+					if (!(b = realloc(buf, cap + k))) {
+						errno = ENOMEM;
+						ok = FALSE;
+						break;
+					}
+					buf = b;
+					cap += k;
+				}
+				k = rfReadAt(in, buf + got, cap - 1 - got, start + got);
+				if (k == (size_t)-1) {
+					ok = FALSE;
+					break;
+				}
+				if ((p = memchr(buf + got, '\n', k)) != NULL) {
+					got = p - buf + 1;
+					break;
+				}
+				got += k;
+				if (!k)
+					break;
+			}
+		}
+		rfClose(in);
+
+		if (ok) {
+			n = got - skip;
+			memmove(buf, buf + skip, n);
+			buf[n] = '\0';
+			sinkInit(&sink, SINK_POINTERS, sizeof(*lines), FALSE, maxSize,
+					NULL);
+			ok = sinkReserve(&sink, n) && splitText(buf, n, &sink, &n);
+		}
+		if (ok) {
+			lines = (char **)sink.a;
+			*lines++ = buf;		// save buffer location for freeLines
+		} else {
+			free(buf);
+		}
+	}
+	if (lineCount)
+		*lineCount = lines ? sink.cnt : 0;
+
+	return lines;
+}
+
+/*
+A FileBatch is one thread's share of a readFiles call: files first,
+first + step, first + 2 * step, and so on.
+*/
+typedef struct FileBatch {
+    const char *const *fileNames;
+    ReadFileResult *results;
+    size_t n;           // number of files in the whole call
+    size_t first;       // index of the batch's first file
+    size_t step;        // distance between the batch's files
+    int textMode;
+    int terminate;
+    size_t maxSize;
+} FileBatch;
+
+// readBatch reads the files of FileBatch arg, storing their results.
+static void
+readBatch(void *arg)
+{
+    FileBatch *b = arg;
+    ReadFileResult *r;
+    size_t i;
+
+    for (i = b->first; i < b->n; i += b->step) {
+        r = &b->results[i];
+        errno = 0;
+        r->buf = readFileAlloc(b->fileNames[i], b->textMode, b->terminate,
+                b->maxSize, &r->length, NULL, NULL, &r->status);
+        r->error = r->buf ? 0 : errno ? errno : EIO;
+    }
+}
+
+/*
+readFiles reads the n files named in fileNames as readFile would, up to
+nThreads at a time, so that the latency of opening and reading each file
+overlaps the others' instead of adding to it.  This pays off most for many
+small files or files on network or spinning storage.  The results are
+stored in order in results[0] through results[n - 1].  Link with -pthread
+on POSIX systems.  If readFile.c is compiled with -DREADFILE_NO_THREADS
+then the files are read one after another.  Include readFile.h before
+calling readFiles.
+ARGUMENTS
+---------
+  Inputs:
+	fileNames	an array of n file names
+	n			the number of files to read
+	textMode    as for readFile
+	terminate   as for readFile
+	maxSize		as for readFile; it applies to each file separately.
+	nThreads	the maximum number of threads to use, including the calling
+				thread.  If nThreads is 0 then four per online processor
+				are used, since the threads spend most of their time
+				waiting for I/O.
+  Outputs:
+	results		an array of n ReadFileResults.  For each file, buf and
+				length are as readFile would return and store, and error
+				is 0 on success or else the errno value readFile set.
+RETURN VALUE
+------------
+readFiles returns the number of files read successfully.  The caller should
+free each non-NULL results[i].buf when it is no longer needed.  If
+fileNames or results is NULL then readFiles sets errno to EINVAL and
+returns 0.
+*/
+size_t
+readFiles(const char *const *fileNames, size_t n, int textMode, int terminate,
+        size_t maxSize, size_t nThreads, ReadFileResult *results)
+{
+    FileBatch one = { fileNames, results, n, 0, 1, textMode, terminate,
+            maxSize };
+    size_t i, ok = 0;
+
+    if (!fileNames || !results) {
+        errno = EINVAL;
+        return 0;
+    }
+#ifdef READFILE_NO_THREADS
+    (void)nThreads;
+    readBatch(&one);
+#else
+    FileBatch *batches = NULL;
+    Task *tasks = NULL;
+    size_t nt;
+
+    if (!nThreads)
+        nThreads = 4 * onlineCPUs();
+    nt = n < nThreads ? n : nThreads;
+    if (nt > 1) {
+        batches = calloc(nt, sizeof(*batches));
+        tasks = calloc(nt, sizeof(*tasks));
+    }
+    if (batches && tasks) {
+        for (i = 0; i < nt; ++i) {
+            batches[i] = one;
+            batches[i].first = i;
+            batches[i].step = nt;
+            tasks[i].fn = readBatch;
+            tasks[i].arg = &batches[i];
+        }
+        runTasks(tasks, nt);
+    } else {
+        readBatch(&one);    // too few files, or no memory for threads
+    }
+    free(batches);
+    free(tasks);
+#endif
+
+    for (i = n; i-- > 0; ) {
+        if (results[i].error)
+            errno = results[i].error;   // leaves the first failure's
+        else
+            ++ok;
+    }
+
+    return ok;
+}
+
+/*
+A MultiFile is one file of a readLinesMulti call.  Its size is found
+first, then its text is read into its slot of the shared text.
+*/
+typedef struct MultiFile {
+    const char *name;
+    char *text;         // the file's slot in the shared text
+    char *temp;         // the text of a file readStream read to size it
+    size_t size;        // chars in the file, then chars read
+    int error;          // errno value, or 0
+} MultiFile;
+
+// A MultiBatch is one thread's share of the files of a readLinesMulti
+// call, as for a FileBatch.
+typedef struct MultiBatch {
+    MultiFile *files;
+    size_t n;
+    size_t first;
+    size_t step;
+    int reading;        // FALSE to find the sizes, TRUE to read the text
+    size_t maxSize;
+} MultiBatch;
+
+/*
+multiBatch finds the sizes of, or reads, the files of MultiBatch arg.  A
+regular file is sized without opening it, so it is opened only once,
+unless readFile.c is compiled to decompress files; it must then be opened
+to check for a codec.  A file whose size isn't known in advance, or that
+is compressed, is read (and decompressed) when it is sized, into a buffer
+of its own that is copied to its slot later.
+*/
+static void
+multiBatch(void *arg)
+{
+    MultiBatch *b = arg;
+    MultiFile *f;
+    RfFile in;
+    size_t i, cap, got;
+    int sized;
+    #ifdef READFILE_DECOMPRESS
+      size_t hint;
+      int codec;
+    #endif
+
+    for (i = b->first; i < b->n; i += b->step) {
+        f = &b->files[i];
+        if (f->error || (b->reading && f->temp)) {
+            if (f->temp)
+                memcpy(f->text, f->temp, f->size);
+            continue;
+        }
+#ifndef READFILE_DECOMPRESS
+        if (!b->reading && rfSizeByName(f->name, &f->size)) {
+            if (b->maxSize && f->size >= b->maxSize)
+                f->error = EFBIG;
+            continue;
+        }
+#endif
+        errno = 0;
+        if ((in = rfOpen(f->name)) == RF_NO_FILE) {
+            f->error = errno ? errno : EIO;
+            continue;
+        }
+        if (b->reading) {
+            if ((got = rfRead(in, f->text, f->size)) == (size_t)-1)
+                f->error = errno ? errno : EIO;
+            else
+                f->size = got;  // less if the file shrank
+        } else if (!rfSize(in, &f->size, &sized)) {
+            f->error = errno ? errno : EIO;
+        } else if (!sized || !f->size) {
+            cap = 0;
+            if (!readStream(in, 0, b->maxSize, NULL, &f->temp, &cap,
+                    &f->size))
+                f->error = errno ? errno : EIO;
+#ifdef READFILE_DECOMPRESS
+        } else if ((codec = rfCodec(in, f->size, &hint)) != CODEC_NONE) {
+            cap = 0;
+            if (!readCompressed(in, f->size, codec, hint, 0, b->maxSize,
+                    TRUE, NULL, &f->temp, &cap, &f->size))
+                f->error = errno ? errno : EIO;
+#endif
+        } else if (b->maxSize && f->size >= b->maxSize) {
+            f->error = EFBIG;
+        }
+        if (f->error && f->temp) {
+            free(f->temp);      // don't hold a partial read until the end
+            f->temp = NULL;
+        }
+        rfClose(in);
+    }
+}
+
+// runMulti runs multiBatch on the files of *one, using up to nThreads
+// threads, as readFiles does.
+static void
+runMulti(MultiBatch *one, size_t nThreads)
+{
+#ifdef READFILE_NO_THREADS
+    (void)nThreads;
+    multiBatch(one);
+#else
+    MultiBatch *batches = NULL;
+    Task *tasks = NULL;
+    size_t i, nt;
+
+    if (!nThreads)
+        nThreads = 4 * onlineCPUs();
+    nt = one->n < nThreads ? one->n : nThreads;
+    if (nt > 1) {
+        batches = calloc(nt, sizeof(*batches));
+        tasks = calloc(nt, sizeof(*tasks));
+    }
+    if (batches && tasks) {
+        for (i = 0; i < nt; ++i) {
+            batches[i] = *one;
+            batches[i].first = i;
+            batches[i].step = nt;
+            tasks[i].fn = multiBatch;
+            tasks[i].arg = &batches[i];
+        }
+        runTasks(tasks, nt);
+    } else {
+        multiBatch(one);    // too few files, or no memory for threads
+    }
+    free(batches);
+    free(tasks);
+#endif
+}
+
+/*
+readLinesMulti reads the lines of the n text files named in fileNames, as
+readLines would, into one array of lines whose text is in one buffer:
+file 0's lines, then file 1's, and so on.  It finds the files' sizes,
+allocates the text buffer once, reads each file straight into its slot,
+and splits all the text in one pass, so there is one allocation pair
+however many files there are, and one freeLines call frees them.  A pipe,
+or a compressed file if readFile.c is compiled to decompress files, is
+read into a buffer of its own while it is sized, and copied to its slot.  The
+files are sized and read up to nThreads at a time, as readFiles reads
+them.  Include readFile.h before calling readLinesMulti.
+ARGUMENTS
+---------
+  Inputs:
+	fileNames	an array of n file names
+	n			the number of files
+	maxSize		as for readLines; it applies to all the files together.
+	nThreads	as for readFiles
+  Outputs:
+	lineCount	receives the total number of lines; may be NULL
+	firstLines	if firstLines is non-NULL then it must have room for n + 1
+				entries.  The lines of file i are lines firstLines[i]
+				through firstLines[i + 1] - 1, and firstLines[n] is the
+				total number of lines.
+RETURN VALUE
+------------
+readLinesMulti returns the same as readLines.  If any file can't be read
+then errno is set to the error of the first such file and NULL is
+returned.
+*/
+char **
+readLinesMulti(const char *const *fileNames, size_t n, size_t maxSize,
+        size_t nThreads, size_t *lineCount, size_t *firstLines)
+{
+    MultiFile *files;
+    MultiBatch one;
+    size_t total = 0;           // chars of text, with a '\0' per file
+    size_t i, length;
+    char *text = NULL;          // the text of all the files
+    char **lines = NULL;        // argv-like array of lines
+    char *b;
+    int err = 0;
+    LineSink sink;
+    Scan sc;
+
+    if (lineCount)
+        *lineCount = 0;
+    if (!fileNames) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!(files = calloc(n ? n : 1, sizeof(*files)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (i = 0; i < n; ++i)
+        files[i].name = fileNames[i];
+    one.files = files;
+    one.n = n;
+    one.first = 0;
+    one.step = 1;
+    one.reading = FALSE;
+    one.maxSize = maxSize;
+
+    // Size the files, and lay out their slots in one buffer.
+    runMulti(&one, nThreads);
+    for (i = 0; i < n && !err; ++i) {
+        if (!(err = files[i].error) && files[i].size >= SIZE_MAX - total)
+            err = EFBIG;
+        total += files[i].size + 1;
+    }
+    if (!err && maxSize && total > maxSize)
+        err = EFBIG;
+    if (!err && !(text = malloc(total ? total : 1)))
+        err = ENOMEM;
+
+    // Read the files into their slots.
+    if (!err) {
+        for (total = i = 0; i < n; ++i) {
+            files[i].text = text + total;
+            total += files[i].size + 1;
+        }
+        one.reading = TRUE;
+        runMulti(&one, nThreads);
+        for (i = 0; i < n && !err; ++i)
+            err = files[i].error;
+    }
+
+    // Split every slot's text into the one array, finishing each slot as
+    // splitText does.  The array is trimmed once, after the last slot.
+    sinkInit(&sink, SINK_POINTERS, sizeof(*lines), FALSE, maxSize, NULL);
+    sink.trim = FALSE;
+    if (!err && !sinkReserve(&sink, total))
+        err = errno;
+    for (i = 0; i < n && !err; ++i) {
+        if (firstLines)
+            firstLines[i] = sink.cnt;
+        b = files[i].text;
+        b[files[i].size] = '\0';
+        scanInit(&sc, b, &sink, NULL);
+        scanRun(&sc, b + files[i].size, TRUE);
+        if (!scanFinish(&sc, &length))
+            err = errno;
+    }
+    if (!err && maxSize && sinkSize(&sink, sink.cnt) + total > maxSize)
+        err = EFBIG;
+
+    if (!err) {
+        if (sink.cnt < sink.cap && (b = realloc(sink.a,
+                sinkSize(&sink, sink.cnt))) != NULL) {
+            sink.a = b;
+            sink.cap = sink.cnt;
+        }
+        sinkPut(&sink, sink.cnt, NULL, 0);
+        lines = (char **)sink.a;
+        *lines++ = text;        // save text location for freeLines
+        if (firstLines)
+            firstLines[n] = sink.cnt;
+        if (lineCount)
+            *lineCount = sink.cnt;
+    } else {
+        free(sink.a);
+        free(text);
+    }
+    for (i = 0; i < n; ++i)
+        free(files[i].temp);
+    free(files);
+    if (err)
+        errno = err;
+
+    return lines;
+}
+
+/*
+An AsyncRead is a readFileAsync request, carried out by runAsyncRead.
+*/
+typedef struct AsyncRead {
+    ReadFileCallback callback;
+    void *userData;
+    int textMode;
+    int terminate;
+    size_t maxSize;
+    struct AsyncRead *next;     // next in the pool's queue
+    char fileName[];    // a copy of the caller's
+} AsyncRead;
+
+// runAsyncRead reads an AsyncRead's file, calls its callback and frees it.
+static void
+runAsyncRead(void *arg)
+{
+    AsyncRead *a = arg;
+    size_t length;
+    char *buf;
+    int error;
+
+    errno = 0;
+    buf = readFile(a->fileName, a->textMode, a->terminate, a->maxSize,
+            &length);
+    error = buf ? 0 : errno ? errno : EIO;
+    a->callback(buf, length, error, a->userData);
+    free(a);
+}
+
+#ifndef READFILE_NO_THREADS
+/*
+asyncPool is readFileAsync's queue of AsyncReads and the detached worker
+threads that serve it.  Workers are started only when more reads are queued
+than workers are idle, up to four per online processor as for readFiles,
+and are kept for later calls.
+*/
+static struct {
+    #ifdef _MSC_VER
+      SRWLOCK lock;
+      CONDITION_VARIABLE ready;
+    #else
+      pthread_mutex_t lock;
+      pthread_cond_t ready;
+    #endif
+    AsyncRead *head, *tail;
+    size_t queued;      // AsyncReads in the queue
+    size_t workers;     // worker threads started
+    size_t idle;        // workers waiting for a read
+    size_t max;         // most workers to start
+} asyncPool = {
+    #ifdef _MSC_VER
+      SRWLOCK_INIT, CONDITION_VARIABLE_INIT,
+    #else
+      PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    #endif
+    NULL, NULL, 0, 0, 0, 0
+};
+
+static Task asyncTask;  // what each worker runs
+
+static void
+asyncLock(void)
+{
+    #ifdef _MSC_VER
+      AcquireSRWLockExclusive(&asyncPool.lock);
+    #else
+      pthread_mutex_lock(&asyncPool.lock);
+    #endif
+}
+
+static void
+asyncUnlock(void)
+{
+    #ifdef _MSC_VER
+      ReleaseSRWLockExclusive(&asyncPool.lock);
+    #else
+      pthread_mutex_unlock(&asyncPool.lock);
+    #endif
+}
+
+// asyncWorker runs the queued AsyncReads one at a time, forever.
+static void
+asyncWorker(void *arg)
+{
+    AsyncRead *a;
+
+    (void)arg;
+    asyncLock();
+    for (;;) {
+        while (!asyncPool.head) {
+            ++asyncPool.idle;
+            #ifdef _MSC_VER
+              SleepConditionVariableSRW(&asyncPool.ready, &asyncPool.lock,
+                      INFINITE, 0);
+            #else
+              pthread_cond_wait(&asyncPool.ready, &asyncPool.lock);
+            #endif
+            --asyncPool.idle;
+        }
+        a = asyncPool.head;
+        if (!(asyncPool.head = a->next))
+            asyncPool.tail = NULL;
+        --asyncPool.queued;
+        asyncUnlock();
+        runAsyncRead(a);
+        asyncLock();
+    }
+}
+
+/*
+asyncQueue queues a for a worker, starting one if none is idle for it, and
+returns TRUE, or sets errno and returns FALSE if there is no worker and
+none can be started.  A worker that can't be started while others run is
+not an error; a will wait for one of them.
+*/
+static int
+asyncQueue(AsyncRead *a)
+{
+    int ok = TRUE, e = 0;
+
+    a->next = NULL;
+    asyncLock();
+    if (asyncPool.tail)
+        asyncPool.tail->next = a;
+    else
+        asyncPool.head = a;
+    asyncPool.tail = a;
+    ++asyncPool.queued;
+    if (!asyncPool.max) {
+        asyncPool.max = 4 * onlineCPUs();
+        asyncTask.fn = asyncWorker;
+    }
+    if (asyncPool.queued > asyncPool.idle &&
+            asyncPool.workers < asyncPool.max) {
+        if (startDetached(&asyncTask))
+            ++asyncPool.workers;
+        else if (!asyncPool.workers) {
+            e = errno;          // a is alone in the queue: take it back
+            asyncPool.head = asyncPool.tail = NULL;
+            asyncPool.queued = 0;
+            ok = FALSE;
+        }
+    }
+    if (ok) {
+        #ifdef _MSC_VER
+          WakeConditionVariable(&asyncPool.ready);
+        #else
+          pthread_cond_signal(&asyncPool.ready);
+        #endif
+    }
+    asyncUnlock();
+    if (e)
+        errno = e;
+
+    return ok;
+}
+#endif  // READFILE_NO_THREADS
+
+/*
+readFileAsync reads the file named fileName as readFile would, but on a
+worker thread, and returns at once.  When the read is done, callback is
+called on that thread with the buffer, its length and an errno value, so
+that an event loop calling readFileAsync never waits for file I/O.  The
+reads are queued for a pool of at most four threads per online processor,
+which are started as needed and kept for later calls, so a burst of calls
+doesn't start a thread for each; reads beyond what the pool can take at
+once wait their turn in the order of the calls.  The
+callback must be thread-safe with respect to the caller; it typically hands
+its arguments back to the loop.  Link with -pthread on POSIX systems.  If
+readFile.c is compiled with -DREADFILE_NO_THREADS then the file is read,
+and callback called, before readFileAsync returns.  Include readFile.h
+before calling readFileAsync.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the file to read; it is copied, so it need not
+				outlive the call.
+	textMode    as for readFile
+	terminate   as for readFile
+	maxSize		as for readFile
+	callback	the function to call with the result.  Its buf argument is
+				what readFile would return, and must be freed by the
+				callback's owner if it is not NULL; length is the data's
+				length, and error is 0 on success or else the errno value
+				readFile set.
+	userData	a pointer passed to callback unchanged
+RETURN VALUE
+------------
+readFileAsync returns TRUE if the read was started, in which case callback
+will be called exactly once.  Otherwise it sets errno and returns FALSE,
+and callback is not called.
+*/
+int
+readFileAsync(const char *fileName, int textMode, int terminate,
+        size_t maxSize, ReadFileCallback callback, void *userData)
+{
+    AsyncRead *a;
+    size_t len;
+
+    if (!fileName || !callback) {
+        errno = EINVAL;
+        return FALSE;
+    }
+    len = strlen(fileName);
+    if (!(a = malloc(sizeof(*a) + len + 1)))
+        return FALSE;
+    a->callback = callback;
+    a->userData = userData;
+    a->textMode = textMode;
+    a->terminate = terminate;
+    a->maxSize = maxSize;
+    memcpy(a->fileName, fileName, len + 1);
+#ifdef READFILE_NO_THREADS
+    runAsyncRead(a);
+#else
+    if (!asyncQueue(a)) {
+        free(a);
+        return FALSE;
+    }
+#endif
+
+    return TRUE;
+}
+
+/*
+readLines reads the entire contents of the text file named fileName into a
+newly-malloc'ed buffer and returns an argv-like array of pointers to the
+lines found in the buffer.  Carriage returns and linefeeds are excluded
+from the lines.  Each line is terminated with '\0'.  Every line is kept,
+empty ones as "", so lines[i] is line i + 1 of the file; only a final
+"\n" doesn't start another line.  Include readFile.h before calling
+readLines or freeLines.  The caller should call freeLines
+when the lines are no longer needed, even if *lineCount is 0.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the text file to read
+	maxSize		If maxSize is non-zero its value sets a limit on the 
+				total memory allocated by readLines, measured in chars.
+                If maxSize is non-zero and inadequate then errno is set to
+                EFBIG and NULL is returned.  If maxSize is zero then there
+                is no limit.
+  Outputs:	
+	lineCount   if lineCount is non-NULL then the number of lines is stored
+                in *lineCount.  It is the number of entries before the
+                terminating NULL pointer, and the array holds exactly that
+                many entries plus the NULL.
+RETURN VALUE
+------------
+readLines returns a pointer to an argv-like array of pointers to the lines or,
+if an error occurs, it sets errno and returns NULL.
+The returned line pointers are followed by a NULL pointer, similar to argv.
+NOTE: An address is hidden before the first entry in lines.  Don't change
+it or compensate in any way for it.
+*/
+char **
+readLines(const char *fileName, size_t maxSize, size_t *lineCount)
+{
+    return readLinesEx(fileName, maxSize, lineCount, NULL, NULL);
+}
+
+/*
+readLinesWithLengths does what readLines does and, if lengths is non-NULL,
+also stores in *lengths a pointer to an array of the lines' lengths in
+chars (excluding the terminating '\0').  The lengths come from the line
+split itself; no line is scanned again.  The lengths array is part of the
+lines' allocation: it needs no separate free and is valid until freeLines
+is called for the lines.  If an error occurs, *lengths is set to NULL.
+maxSize includes the memory for the lengths.
+*/
+char **
+readLinesWithLengths(const char *fileName, size_t maxSize, size_t *lineCount,
+        size_t **lengths)
+{
+    return readLinesEx(fileName, maxSize, lineCount, lengths, NULL);
+}
+
+// readLinesAlloc does what readLinesEx does, with stats and status as for
+// readFileAlloc.
+static char **
+readLinesAlloc(const char *fileName, size_t maxSize, size_t *lineCount,
+        size_t **lengths, const ReadFileAllocator *allocator,
+        ReadFileStats *stats, ReadFileStatus *status)
+{
+    char *buf = NULL;           // pointer to text read by readFileBuf
+    size_t cap = 0;             // size of buf
+    size_t length;              // length of text after the split
+    size_t lnCnt = 0;           // local line count
+    char **lines = NULL;        // argv-like array of lines found in fileName
+    LineSink sink;
+    ReadFileStatus st;
+
+    // Read in binary mode; the split removes carriage returns.  Store the
+    // address of readFileBuf's buffer as a hidden line at lines' beginning.
+    sinkInit(&sink, SINK_POINTERS, sizeof(*lines), lengths != NULL, maxSize,
+            allocator);
+    st = readFileBuf(fileName, FALSE, TRUE, maxSize, TRUE, allocator, &buf,
+            &cap, &length, stats, &sink, NULL);
+    if (status)
+        *status = st;
+    if (gotData(st)) {
+        lines = (char **)sink.a;
+        *lines++ = buf;         // save readFileBuf buffer location
+        lnCnt = sink.cnt;
+    } else {
+        rfFree(allocator, sink.a);  // NULL if the split freed it
+        rfFree(allocator, buf);
+    }
+
+	if (lineCount)
+		*lineCount = lnCnt;
+	if (lengths)
+		*lengths = lines ? (size_t *)(lines + lnCnt + 1) : NULL;
+
+	return lines;
+}
+
+/*
+readLinesEx does what readLinesWithLengths does, but gets both the text
+buffer and the line array from allocator (see readFileEx) instead of
+malloc.  lengths may be NULL, as for readLinesWithLengths.  The caller
+should call freeLinesEx with the same allocator when the lines are no
+longer needed, even if *lineCount is 0, unless the allocator's memory is
+released some other way, such as by resetting an arena.
+*/
+char **
+readLinesEx(const char *fileName, size_t maxSize, size_t *lineCount,
+        size_t **lengths, const ReadFileAllocator *allocator)
+{
+    return readLinesAlloc(fileName, maxSize, lineCount, lengths, allocator,
+            NULL, NULL);
+}
+
+/*
+readLinesStatusEx does what readLinesEx does, but returns a ReadFileStatus
+as readFileStatusEx does.  The lines are stored in *lines, which is NULL
+unless READFILE_OK or READFILE_SHORT_READ is returned.  Free them with
+freeLinesEx.  Include readFile.h before calling readLinesStatusEx.
+*/
+ReadFileStatus
+readLinesStatusEx(const char *fileName, size_t maxSize,
+        const ReadFileAllocator *allocator, char ***lines, size_t *lineCount)
+{
+    ReadFileStatus st;
+
+    *lines = readLinesAlloc(fileName, maxSize, lineCount, NULL, allocator,
+            NULL, &st);
+
+    return st;
+}
+
+/*
+readRecords reads the file named fileName and returns an argv-like array
+of pointers to its records, as readLines does for lines.  Records are
+separated by the delimiterLength chars at delimiter, such as "\0" for the
+output of find -print0 or "\x1e" for a record-separator stream; or, if
+recordSize is not 0, each is recordSize chars (but the last may be
+shorter) and delimiter is ignored.  Delimiters are excluded from the
+records, a delimiter at the end of the file doesn't start an empty record,
+each record is terminated with '\0', and carriage returns are kept.
+Files of 16 MB or more are split as they are read, as by readLines.
+Records may contain '\0', so binary records are best measured by lengths.
+Include readFile.h before calling readRecords.
+ARGUMENTS
+---------
+  Inputs:
+	fileName		the name of the file to read
+	delimiter		the chars that end each record
+	delimiterLength	the number of chars at delimiter
+	recordSize		the size of each record in chars, or 0 to use delimiter
+	maxSize			as for readLines
+  Outputs:
+	recordCount		receives the number of records; may be NULL
+	lengths			receives an array of the records' lengths, part of the
+					records' allocation, as for readLinesWithLengths; may be
+					NULL
+RETURN VALUE
+------------
+readRecords returns a pointer to an array of records terminated by a NULL
+pointer, which freeLines frees, or NULL with errno set if an error occurs.
+*/
+char **
+readRecords(const char *fileName, const char *delimiter,
+        size_t delimiterLength, size_t recordSize, size_t maxSize,
+        size_t *recordCount, size_t **lengths)
+{
+    char *buf = NULL;           // pointer to text read by readFileBuf
+    size_t cap = 0;             // size of buf
+    size_t n = 0;               // length of text
+    size_t cnt = 0;             // number of records
+    size_t i, k;
+    char **lines = NULL;        // argv-like array of records
+    char *b;
+    int ok;
+    LineSink sink;
+    Scan sc;
+
+    sinkInit(&sink, SINK_POINTERS, sizeof(*lines), lengths != NULL, maxSize,
+            NULL);
+    if (!recordSize && (!delimiter || !delimiterLength)) {
+        errno = EINVAL;
+        ok = FALSE;
+    } else if (!recordSize) {
+        // The delimiter is found as the file is read, or afterwards.
+        sink.delim = delimiter;
+        sink.delimLen = delimiterLength;
+        ok = gotData(readFileBuf(fileName, FALSE, TRUE, maxSize, TRUE, NULL,
+                &buf, &cap, &n, NULL, &sink, NULL));
+    } else {
+        // Spread the records out from the end to make room for each '\0'.
+        ok = gotData(readFileBuf(fileName, FALSE, TRUE, maxSize, FALSE, NULL,
+                &buf, &cap, &n, NULL, NULL, NULL));
+        if (ok) {
+            cnt = n / recordSize + (n % recordSize != 0);
+            if (maxSize && n + cnt + 1 > maxSize) {
+                errno = EFBIG;
+                ok = FALSE;
+            } else if (n + cnt + 1 > cap) {
+                if ((b = realloc(buf, n + cnt + 1)) != NULL)
+                    buf = b;
+                else {
+                    errno = ENOMEM;
+                    ok = FALSE;
+                }
+            }
+        }
+        if (ok) {
+            for (i = cnt; i-- > 0; ) {
+                k = i + 1 < cnt ? recordSize : n - i * recordSize;
+                memmove(buf + i * (recordSize + 1), buf + i * recordSize, k);
+                buf[i * (recordSize + 1) + k] = '\0';
+            }
+            ok = sinkReserve(&sink, n);
+        }
+        if (ok) {
+            scanInit(&sc, buf, &sink, NULL);
+            for (i = 0; i < cnt && sc.ok; ++i)
+                sc.ok = sinkAdd(&sink, buf, i * (recordSize + 1), n + cnt);
+            sc.d = sc.start = buf + n + cnt;
+            ok = scanFinish(&sc, &n);
+        }
+    }
+
+    if (ok) {
+        lines = (char **)sink.a;
+        *lines++ = buf;         // save buffer location for freeLines
+        cnt = sink.cnt;
+    } else {
+        free(sink.a);           // NULL if the split freed it
+        free(buf);
+        cnt = 0;
+    }
+    if (recordCount)
+        *recordCount = cnt;
+    if (lengths)
+        *lengths = lines ? (size_t *)(lines + cnt + 1) : NULL;
+
+    return lines;
+}
+
+/*
+readLinesWithStats does what readLines does, and also stores in *stats how
+long each phase took and what it did.  readLines splits, counts lines and
+removes carriage returns in a single pass, so all of that is timed as
+splitNs.  stats may be NULL.
+ARGUMENTS
+---------
+  Inputs:
+	fileName and maxSize are as for readLines.
+  Outputs:
+	lineCount   as for readLines
+	stats		if stats is non-NULL then *stats is filled in as for
+				readFileWithStats, except that crlfNs is 0 and:
+				splitNs		nanoseconds spent removing carriage returns,
+							finding lines and storing pointers to them
+				crsRemoved	the number of carriage returns removed
+				lines		the number of lines found
+RETURN VALUE
+------------
+readLinesWithStats returns the same as readLines.
+*/
+char **
+readLinesWithStats(const char *fileName, size_t maxSize, size_t *lineCount,
+        ReadFileStats *stats)
+{
+    return readLinesAlloc(fileName, maxSize, lineCount, NULL, NULL, stats,
+            NULL);
+}
+
+/*
+readLinesInto does what readLines does, but reuses the line array and text
+buffer from the previous call, growing them only when needed.  Re-reading
+similarly sized files therefore settles into no allocation at all.  *lines
+must be NULL on the first call and is replaced by the new lines on each
+call; the previous lines are no longer valid.  linesCapacity and
+textCapacity hold the sizes of the line array (in lines) and of the text
+buffer (in chars); the caller should set them to 0 with *lines but need not
+otherwise use them.  The caller should call freeLines(*lines) when done.
+If an error occurs, both buffers are freed, *lines is set to NULL, the
+capacities and *lineCount to 0, errno is set and NULL is returned.
+*/
+char **
+readLinesInto(const char *fileName, size_t maxSize, char ***lines,
+        size_t *linesCapacity, size_t *textCapacity, size_t *lineCount)
+{
+    char *buf = NULL;           // text buffer, reused if *lines isn't NULL
+    size_t length;              // length of text read
+    size_t lnCnt = 0;           // local line count
+    char **ln = NULL;           // argv-like array of lines found in fileName
+    LineSink sink;
+    int ok;
+
+    if (!lines || !linesCapacity || !textCapacity) {
+        errno = EINVAL;
+    } else {
+        sinkInit(&sink, SINK_POINTERS, sizeof(*ln), FALSE, maxSize, NULL);
+        if (*lines) {
+            buf = (*lines)[-1];
+            sink.a = (char *)(*lines - 1);
+            sink.cap = *linesCapacity;
+            sink.trim = FALSE;
+        } else {
+            *linesCapacity = *textCapacity = 0;
+        }
+        ok = gotData(readFileBuf(fileName, FALSE, TRUE, maxSize, FALSE,
+                NULL, &buf, textCapacity, &length, NULL, NULL, NULL)) &&
+            sinkReserve(&sink, length) &&
+            splitText(buf, length, &sink, &length);
+        if (ok) {
+            ln = (char **)sink.a;
+            *ln++ = buf;        // save text buffer location
+            lnCnt = sink.cnt;
+            *linesCapacity = sink.cap;
+        } else {
+            free(sink.a);       // splitText leaves NULL if it freed it
+            free(buf);
+            *linesCapacity = *textCapacity = 0;
+        }
+        *lines = ln;
+    }
+
+	if (lineCount)
+		*lineCount = lnCnt;
+
+	return ln;
+}
+
+/*
+freeLines frees memory allocated by readLines, readLinesWithLengths or
+readLinesParallel.
+ARGUMENTS
+---------
+  Inputs:
+    lines   a pointer to lines allocated by readLines, readLinesWithLengths
+            or readLinesParallel.  A NULL argument is acceptable and has no
+            effect.
+*/
+void
+freeLines(char **lines)
+{
+    freeLinesEx(lines, NULL);
+}
+
+/*
+freeLinesEx frees memory allocated by readLinesEx through allocator, which
+must be the allocator passed to readLinesEx.
+*/
+void
+freeLinesEx(char **lines, const ReadFileAllocator *allocator)
+{
+    if (lines) {
+        --lines;
+        rfFree(allocator, *lines);
+        rfFree(allocator, lines);
+    }
+}
+
+
+/*
+readLinesIndex reads the text file named fileName as readLines does, but
+returns the lines as a LineIndex: the text plus an array of the offsets at
+which the lines start.  The offsets are uint32_t unless the file exceeds
+4 GB, so for most files the index takes half the memory of readLines'
+pointers on 64-bit systems.  Use lineIndexLine and lineIndexLength to reach
+line i in O(1) time.  Include readFile.h before calling readLinesIndex.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the text file to read
+	maxSize		If maxSize is non-zero its value sets a limit on the
+				total memory allocated by readLinesIndex, measured in chars.
+                If maxSize is non-zero and inadequate then errno is set to
+                EFBIG and NULL is returned.  If maxSize is zero then there
+                is no limit.
+RETURN VALUE
+------------
+readLinesIndex returns a pointer to a LineIndex or, if an error occurs, it
+sets errno and returns NULL.  In the LineIndex, buf holds the text with each
+line terminated by '\0', length is the text's length in chars, lineCount is
+the number of lines, wide is non-zero if offsets holds uint64_t rather than
+uint32_t, and offsets holds lineCount+1 entries; the last is the offset just
+past the last line's '\0'.  The caller should call freeLineIndex when the
+index is no longer needed, even if lineCount is 0.
+*/
+LineIndex *
+readLinesIndex(const char *fileName, size_t maxSize)
+{
+    // Keep the offsets after the LineIndex aligned for uint64_t.
+    const size_t head = (sizeof(LineIndex) + 7) / 8 * 8;
+    char *buf;                  // pointer to text returned by readFile
+    size_t length;              // length of text returned by readFile
+    LineIndex *index = NULL;
+    LineSink sink;
+    int kind;
+
+    buf = readFile(fileName, FALSE, TRUE, maxSize, &length);
+    if (buf) {
+        kind = length < UINT32_MAX ? SINK_OFFSETS32 : SINK_OFFSETS64;
+        sinkInit(&sink, kind, head, FALSE, maxSize, NULL);
+        if (sinkReserve(&sink, length) &&
+                splitText(buf, length, &sink, &length)) {
+            index = (LineIndex *)sink.a;
+            index->buf = buf;
+            index->length = length;
+            index->lineCount = sink.cnt;
+            index->wide = kind == SINK_OFFSETS64;
+            index->offsets = sink.a + head;
+        } else
+            free(buf);
+    }
+
+    return index;
+}
+
+/*
+lineIndexLine returns a pointer to line i of index, or NULL if i is not less
+than index->lineCount.
+*/
+const char *
+lineIndexLine(const LineIndex *index, size_t i)
+{
+    if (i >= index->lineCount)
+        return NULL;
+    return index->buf + (index->wide ? ((const uint64_t *)index->offsets)[i] :
+            ((const uint32_t *)index->offsets)[i]);
+}
+
+/*
+lineIndexLength returns the length in chars (excluding the terminating
+'\0') of line i of index, or 0 if i is not less than index->lineCount.
+*/
+size_t
+lineIndexLength(const LineIndex *index, size_t i)
+{
+    if (i >= index->lineCount)
+        return 0;
+    if (index->wide) {
+        const uint64_t *off = index->offsets;
+        return (size_t)(off[i+1] - off[i] - 1);
+    } else {
+        const uint32_t *off = index->offsets;
+        return off[i+1] - off[i] - 1;
+    }
+}
+
+/*
+freeLineIndex frees memory allocated by readLinesIndex.
+ARGUMENTS
+---------
+  Inputs:
+    index   a pointer returned by readLinesIndex.  A NULL argument is
+            acceptable and has no effect.
+*/
+void
+freeLineIndex(LineIndex *index)
+{
+    if (index) {
+        free(index->buf);
+        free(index);
+    }
+}
+
+#ifndef READFILE_NO_THREADS
+/*
+A LineChunk is the part of readLinesParallel's buffer handled by one thread.
+Each chunk but the last ends with '\n', so no "\r\n" spans two chunks and
+chunks can be compacted independently.  Compacted chunks are not moved
+together; the gaps between them are simply not referenced by any line.
+*/
+typedef struct LineChunk {
+    char *p;        // chunk start
+    size_t n;       // chunk length; after compaction, its compacted length
+    size_t lines;   // lines in the chunk
+    char **slot;    // first line pointer owned by the chunk
+    int last;       // TRUE for the chunk at the end of the buffer
+} LineChunk;
+
+// compactChunk removes the chunk's carriage returns and counts its lines.
+static void
+compactChunk(void *arg)
+{
+    LineChunk *c = arg;
+
+    c->lines = 0;
+    c->n = removeCRLF(c->p, c->n, &c->lines);
+    if (c->last) {
+        c->lines += c->n && c->p[c->n - 1] != '\n';  // line with no '\n' at EOF
+        c->p[c->n] = '\0';
+    }
+}
+
+// fillChunk terminates the chunk's lines and stores pointers to them.
+static void
+fillChunk(void *arg)
+{
+    LineChunk *c = arg;
+    char *s = c->p, *end = c->p + c->n, *q, **ln = c->slot;
+
+    while ((q = memchr(s, '\n', end - s))) {
+        *ln++ = s;
+        *q = '\0';
+        s = q + 1;
+    }
+    if (s < end)
+        *ln = s;
+}
+
+/*
+splitChunks splits the length chars of text in buf, which has room for a
+terminating '\0' and came from malloc, into lines as readLinesParallel
+does, using up to nThreads threads.  buf becomes part of the returned
+array, or is freed if the array can't be made.
+*/
+static char **
+splitChunks(char *buf, size_t length, size_t maxSize, size_t nThreads,
+        size_t *lineCount)
+{
+    const size_t minChunk = 1 << 20;    // don't start a thread for less
+    size_t used = 0;            // chars of text after compaction
+    size_t lnCnt = 0;           // local line count
+    size_t i, nc, at;
+    char *q, **lines = NULL;
+    LineChunk *chunks = NULL;
+    Task *tasks = NULL;
+
+    nc = length / minChunk + 1;
+    if (nc > nThreads)
+        nc = nThreads;
+    chunks = calloc(nc, sizeof(*chunks));
+    tasks = calloc(nc, sizeof(*tasks));
+    if (chunks && tasks) {
+        // Split after the first '\n' at or beyond each nominal boundary.
+        for (i = at = 0; i < nc && at < length; ++i) {
+            size_t want = length / nc * (i + 1);
+            size_t from = want > at ? want - 1 : at;
+            chunks[i].p = buf + at;
+            q = i + 1 < nc ? memchr(buf + from, '\n', length - from) : NULL;
+            at = q ? (size_t)(q + 1 - buf) : length;
+            chunks[i].n = buf + at - chunks[i].p;
+            chunks[i].last = at == length;
+        }
+        if (!(nc = i)) {    // empty file
+            chunks[0].p = buf;
+            chunks[0].last = TRUE;
+            nc = 1;
+        }
+
+        for (i = 0; i < nc; ++i) {
+            tasks[i].fn = compactChunk;
+            tasks[i].arg = &chunks[i];
+        }
+        runTasks(tasks, nc);
+        for (i = 0; i < nc; ++i) {
+            lnCnt += chunks[i].lines;
+            used += chunks[i].n;
+        }
+
+        if (!maxSize ||
+                (lnCnt + 1+1) * sizeof(*lines) + used + 1 <= maxSize) {
+            if ((lines = malloc((lnCnt + 1+1) * sizeof(*lines)))) {
+                *lines++ = buf;    // save readFile buffer location
+                for (at = i = 0; i < nc; ++i) {
+                    chunks[i].slot = lines + at;
+                    at += chunks[i].lines;
+                    tasks[i].fn = fillChunk;
+                }
+                runTasks(tasks, nc);
+                lines[lnCnt] = NULL;
+            }
+        } else {
+            errno = EFBIG;
+        }
+    }
+    free(chunks);
+    free(tasks);
+    if (!lines) {
+        lnCnt = 0;
+        free(buf);
+    }
+
+    *lineCount = lnCnt;
+
+    return lines;
+}
+#endif
+
+/*
+readLinesParallel does what readLines does, using nThreads threads to
+remove carriage returns, count lines and fill the line pointers.  The
+buffer is split into one chunk per thread at line boundaries.  Each thread
+compacts and counts its chunk; a prefix sum of the counts then gives each
+thread its own slice of lines to fill.  The result is identical to
+readLines' and is freed with freeLines.  Link with -pthread on POSIX
+systems.  If readFile.c is compiled with -DREADFILE_NO_THREADS then
+readLinesParallel simply calls readLines.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the text file to read
+	maxSize		as for readLines
+	nThreads	the maximum number of threads to use, including the calling
+				thread.  If nThreads is 0 then the number of online
+				processors is used.  Fewer threads are used for small files.
+  Outputs:
+	lineCount   as for readLines
+RETURN VALUE
+------------
+readLinesParallel returns the same as readLines.
+*/
+char **
+readLinesParallel(const char *fileName, size_t maxSize, size_t nThreads,
+        size_t *lineCount)
+{
+#ifdef READFILE_NO_THREADS
+    (void)nThreads;
+    return readLines(fileName, maxSize, lineCount);
+#else
+    char *buf;                  // pointer to text returned by readFile
+    size_t length;              // length of text returned by readFile
+    size_t lnCnt = 0;           // local line count
+    char **lines = NULL;
+
+    if (!nThreads)
+        nThreads = onlineCPUs();
+    if ((buf = readFile(fileName, FALSE, TRUE, maxSize, &length)))
+        lines = splitChunks(buf, length, maxSize, nThreads, &lnCnt);
+
+    if (lineCount)
+        *lineCount = lnCnt;
+
+    return lines;
+#endif
+}
+
+
+/*
+readFileMapped maps the entire contents of the file named fileName into
+memory read-only and returns a pointer to the mapped view.  No buffer is
+allocated and no data is copied; pages are brought in by the operating
+system as they are touched.  Include readFile.h before calling
+readFileMapped or freeFileMapped.  The view is equivalent to a binary-mode
+readFile with terminate zero: it is not '\0'-terminated and carriage
+returns are not removed.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the file to map
+	maxSize		If maxSize is non-zero its value sets a limit on the size of
+				the file, measured in chars.  If maxSize is non-zero and
+				inadequate then errno is set to EFBIG and NULL is returned.
+				If maxSize is zero then there is no limit.
+  Outputs:
+	length      if length is non-NULL then the length of the view in chars
+				is stored in *length.
+RETURN VALUE
+------------
+readFileMapped returns a pointer to a read-only view of the file's contents
+or, if an error occurs, it sets errno and returns NULL.  The caller should
+pass the returned pointer and its length to freeFileMapped when the view is
+no longer needed, even if *length is 0.  Writing through the returned
+pointer is undefined behavior.
+*/
+const char *
+readFileMapped(const char *fileName, size_t maxSize, size_t *length)
+{
+    static const char empty[1] = "";  // view returned for an empty file
+    const char *view = NULL;
+    size_t fsize = 0;
+    int sized;
+    RfFile f;
+
+    if (!fileName) {
+        errno = EINVAL;
+    } else if ((f = rfOpen(fileName)) != RF_NO_FILE) {
+        if (rfSize(f, &fsize, &sized)) {
+            if (!sized) {
+                errno = ESPIPE;     // only files and disks can be mapped
+            } else if (maxSize && fsize > maxSize) {
+                errno = EFBIG;
+            } else if (!fsize) {
+                view = empty;
+            } else {
+                #ifdef _MSC_VER
+                  HANDLE map = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0,
+                          NULL);
+                  if (map) {
+                      view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+                      CloseHandle(map);   // the view keeps the mapping alive
+                  }
+                  if (!view)
+                      setErrnoWin();
+                #else
+                  void *p = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, f, 0);
+                  if (p != MAP_FAILED)
+                      view = p;
+                #endif
+            }
+        }
+        rfClose(f);     // the mapping remains valid after close
+    }
+
+    if (!view)
+        fsize = 0;
+
+    if (length)
+        *length = fsize;
+
+    return view;
+}
+
+/*
+freeFileMapped releases a view returned by readFileMapped.
+ARGUMENTS
+---------
+  Inputs:
+    view    a pointer returned by readFileMapped.  A NULL argument is
+            acceptable and has no effect.
+    length  the length stored by readFileMapped in *length.
+*/
+void
+freeFileMapped(const char *view, size_t length)
+{
+    if (view && length) {
+        #ifdef _MSC_VER
+          UnmapViewOfFile(view);
+        #else
+          munmap((void *)view, length);
+        #endif
+    }
+}
+
+/*
+The Auto functions choose among readFile, readFileDirect and
+readLinesParallel for each file by its size, the kind of file system it's
+on, whether it seems to be in the OS's page cache, and the number of
+processors.  The sizes at which they switch are in rfTuning; see
+readFileSetTuning.  Small files aren't examined beyond a stat.
+*/
+#define RF_DEFAULT_TUNING { \
+    (size_t)256 << 20,      /* directMin */ \
+    (size_t)512 << 20,      /* directTextMin */ \
+    (size_t)8 << 20,        /* parallelMin */ \
+}
+
+static ReadFileTuning rfTuning = RF_DEFAULT_TUNING;
+
+#define FS_LOCAL    0       // a disk, or anything not known to differ
+#define FS_MEMORY   1       // tmpfs and the like: always cached
+#define FS_NETWORK  2       // NFS, SMB and the like
+
+#define AUTO_BUFFERED   0   // read as readFile or readLines does
+#define AUTO_DIRECT     1   // read as readFileDirect does
+#define AUTO_PARALLEL   2   // split as readLinesParallel does
+
+// rfFileSystem returns FS_LOCAL, FS_MEMORY or FS_NETWORK for the file
+// system holding fileName.
+static int
+rfFileSystem(const char *fileName)
+{
+    #ifdef _MSC_VER
+      char root[MAX_PATH];
+      if (GetVolumePathNameA(fileName, root, MAX_PATH)) {
+          switch (GetDriveTypeA(root)) {
+          case DRIVE_REMOTE:
+              return FS_NETWORK;
+          case DRIVE_RAMDISK:
+              return FS_MEMORY;
+          }
+      }
+    #elif defined(__linux__)
+      struct statfs s;
+      if (!statfs(fileName, &s)) {
+          switch ((uint32_t)s.f_type) {
+          case 0x01021994:  // tmpfs
+          case 0x858458f6:  // ramfs
+              return FS_MEMORY;
+          case 0x00006969:  // NFS
+          case 0x0000517b:  // SMB
+          case 0xff534d42:  // CIFS
+          case 0xfe534d42:  // SMB2
+          case 0x00c36400:  // Ceph
+          case 0x0bd00bd0:  // Lustre
+          case 0x5346414f:  // AFS
+              return FS_NETWORK;
+          }
+      }
+    #elif defined(MNT_LOCAL)
+      struct statfs s;
+      if (!statfs(fileName, &s)) {
+          if (!(s.f_flags & MNT_LOCAL))
+              return FS_NETWORK;
+          if (!strcmp(s.f_fstypename, "tmpfs"))
+              return FS_MEMORY;
+      }
+    #endif
+    return FS_LOCAL;
+}
+
+/*
+rfCached returns TRUE if most of a sample of the pages of the file named
+fileName, of fsize chars, are in the OS's page cache.  It returns TRUE too
+if it can't tell, as on Windows or (on Linux, which tells only those who
+may write a file) for another user's read-only file, so that such files
+are read through the cache as readFile reads them.
+*/
+static int
+rfCached(const char *fileName, size_t fsize)
+{
+    #ifdef _MSC_VER
+      (void)fileName;
+      (void)fsize;
+      return TRUE;
+    #else
+      const size_t samples = 16;
+      size_t page = (size_t)sysconf(_SC_PAGESIZE);
+      size_t pages = (fsize + page - 1) / page, i, hits = 0;
+      unsigned char in;
+      void *p = MAP_FAILED;
+      RfFile f;
+      #ifdef __linux__
+        struct stat st;
+      #endif
+
+      if ((f = rfOpen(fileName)) == RF_NO_FILE)
+          return TRUE;
+      #ifdef __linux__
+        if (!fstat(f, &st) && (st.st_uid == geteuid() ||
+                !access(fileName, W_OK)))
+      #endif
+          p = mmap(NULL, fsize, PROT_READ, MAP_SHARED, f, 0);
+      rfClose(f);
+      if (p == MAP_FAILED)
+          return TRUE;
+      for (i = 0; i < samples; ++i) {
+          if (!mincore((char *)p + pages * i / samples * page, 1,
+                  (void *)&in))
+              hits += in & 1;
+      }
+      munmap(p, fsize);
+      return hits * 2 >= samples;
+    #endif
+}
+
+// autoPlan returns AUTO_BUFFERED, AUTO_DIRECT or AUTO_PARALLEL to tell how
+// readFileAuto (or readLinesAuto, if lines is TRUE) should read fileName.
+// nThreads receives the number of threads a split may use.
+static int
+autoPlan(const char *fileName, int textMode, int lines, size_t *nThreads)
+{
+    ReadFileTuning tn = rfTuning;
+    size_t fsize;
+    size_t direct = textMode || lines ? tn.directTextMin : tn.directMin;
+    int savedErrno = errno, fs, cached, plan = AUTO_BUFFERED;
+
+    #ifdef READFILE_NO_THREADS
+      *nThreads = 1;
+      direct = lines ? 0 : direct;      // no splitChunks to split with
+    #else
+      *nThreads = onlineCPUs();
+    #endif
+    if (*nThreads < 2 || !lines)
+        tn.parallelMin = 0;
+
+    // Pipes, /proc files, the standard input and files that are too small
+    // for the other ways are read as readFile reads them.
+    if (!fileName || !strcmp(fileName, "-") ||
+            !rfSizeByName(fileName, &fsize) ||
+            ((!direct || fsize < direct) &&
+             (!tn.parallelMin || fsize < tn.parallelMin)))
+        return AUTO_BUFFERED;
+
+#ifdef READFILE_DECOMPRESS
+    // A compressed file's size says little about the work of reading it,
+    // and only readFile's reads decompress, so it is read as readFile does.
+    if (rfCodecByName(fileName) != CODEC_NONE) {
+        errno = savedErrno;
+        return AUTO_BUFFERED;
+    }
+#endif
+
+    // A network file system has its own cache, which direct I/O would skip,
+    // and its latency is best hidden by readLines' overlap of reading and
+    // splitting, so it's always read buffered.
+    if ((fs = rfFileSystem(fileName)) != FS_NETWORK) {
+        cached = fs == FS_MEMORY || rfCached(fileName, fsize);
+        if (cached && tn.parallelMin && fsize >= tn.parallelMin)
+            plan = AUTO_PARALLEL;
+        else if (!cached && direct && fsize >= direct)
+            plan = AUTO_DIRECT;
+    }
+    errno = savedErrno;
+    return plan;
+}
+
+/*
+readFileSetTuning sets the file sizes, in chars, at which readFileAuto
+and readLinesAuto switch from one way of reading to another, for all
+threads.  Call it before any thread calls an Auto function.  If tuning is
+NULL the defaults are restored.  The benchmark at the end of readFile.c,
+run with -t, measures the sizes for the machine it runs on and prints the
+call to make.  Include readFile.h before calling readFileSetTuning or
+readFileGetTuning.
+*/
+void
+readFileSetTuning(const ReadFileTuning *tuning)
+{
+    static const ReadFileTuning defaults = RF_DEFAULT_TUNING;
+
+    rfTuning = tuning ? *tuning : defaults;
+}
+
+// readFileGetTuning stores the sizes set by readFileSetTuning in *tuning.
+void
+readFileGetTuning(ReadFileTuning *tuning)
+{
+    *tuning = rfTuning;
+}
+
+/*
+readFileAuto does what readFile does, reading fileName the way that should
+be fastest for it: an uncached file on a local disk of at least directMin
+chars (directTextMin in text mode, which loses readFile's overlap of
+reading and removing carriage returns) with readFileDirect, and anything
+else, including a compressed file when readFile.c is compiled to
+decompress files, with readFile.  See readFileSetTuning.  Include
+readFile.h before calling readFileAuto.
+ARGUMENTS
+---------
+  Inputs:
+	fileName, textMode, terminate and maxSize are as for readFile.
+  Outputs:
+	length      as for readFile
+RETURN VALUE
+------------
+readFileAuto returns the same as readFile.  The buffer may be passed to
+free.
+*/
+char *
+readFileAuto(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length)
+{
+	size_t nThreads;
+
+	if (autoPlan(fileName, textMode, FALSE, &nThreads) == AUTO_DIRECT)
+		return readFileDirect(fileName, textMode, terminate, maxSize, length);
+	return readFile(fileName, textMode, terminate, maxSize, length);
+}
+
+/*
+readLinesAuto does what readLines does, reading fileName the way that
+should be fastest for it.  A cached file (or one on tmpfs) of at least
+parallelMin chars is split on every processor, as readLinesParallel does;
+an uncached file on a local disk of at least directTextMin chars is read
+with direct I/O, as readFileDirect does, and then split the same way;
+anything else, including every file on a network file system and any
+compressed file readFile.c is compiled to decompress, is read by readLines.
+See readFileSetTuning.  Include readFile.h before calling
+readLinesAuto.
+ARGUMENTS
+---------
+  Inputs:
+	fileName and maxSize are as for readLines.
+  Outputs:
+	lineCount   as for readLines
+RETURN VALUE
+------------
+readLinesAuto returns the same as readLines, to be freed with freeLines.
+*/
+char **
+readLinesAuto(const char *fileName, size_t maxSize, size_t *lineCount)
+{
+	size_t nThreads;
+
+	switch (autoPlan(fileName, TRUE, TRUE, &nThreads)) {
+	case AUTO_PARALLEL:
+		return readLinesParallel(fileName, maxSize, nThreads, lineCount);
+#ifndef READFILE_NO_THREADS
+	case AUTO_DIRECT: {
+		size_t length, lnCnt = 0;
+		char *buf, **lines = NULL;
+
+		if ((buf = readFileDirect(fileName, FALSE, TRUE, maxSize, &length)))
+			lines = splitChunks(buf, length, maxSize, nThreads, &lnCnt);
+		if (lineCount)
+			*lineCount = lnCnt;
+		return lines;
+	}
+#endif
+	}
+	return readLines(fileName, maxSize, lineCount);
+}
+
+/*
+A LineView finds the lines of a text in place, only as far as the lines
+asked for.  It records the start of every LINE_VIEW_STRIDE'th line as a
+checkpoint, finding them a block of lines at a time as later lines are
+asked for, and counts lines from the nearest checkpoint, or from the last
+line found, to reach any line.  copySpan finds the linefeeds a vector at a
+time without storing anything.
+*/
+#define LINE_VIEW_STRIDE 4096
+
+struct LineView {
+    const char *text;   // the lines
+    size_t length;      // length of text in chars
+    int mapped;         // TRUE if text is from readFileMapped
+    size_t *marks;      // marks[k] is the start of line k * LINE_VIEW_STRIDE
+    size_t markCount;   // checkpoints found
+    size_t markCap;     // checkpoints allocated
+    int complete;       // TRUE once the end of text has been reached
+    size_t lineCount;   // number of lines, once complete
+    size_t cursorLine;  // the last line found
+    size_t cursorOff;   // the start of cursorLine
+};
+
+// lineViewEnd returns the offset of the '\n' ending the line at off of
+// view, or view->length if it isn't ended.
+static size_t
+lineViewEnd(const LineView *view, size_t off)
+{
+    const char *s = view->text + off;
+
+    return off + copySpan((char *)s, s, view->length - off, '\n', '\n');
+}
+
+/*
+lineViewExtend finds the lines of the block after view's last
+checkpoint, adding a checkpoint for the next block or marking view
+complete.  It returns FALSE with errno set if memory is exhausted.
+*/
+static int
+lineViewExtend(LineView *view)
+{
+    size_t base = (view->markCount - 1) * LINE_VIEW_STRIDE;
+    size_t off = view->marks[view->markCount - 1];
+    size_t j;
+    size_t *m;
+
+    for (j = 0; j < LINE_VIEW_STRIDE && off < view->length; ++j)
+        off = lineViewEnd(view, off) + 1;
+    if (j < LINE_VIEW_STRIDE || off >= view->length) {
+        view->complete = TRUE;
+        view->lineCount = base + j;
+        return TRUE;
+    }
+    if (view->markCount == view->markCap) {
+        m = realloc(view->marks, 2 * view->markCap * sizeof(*m));
+        if (!m) {
+            errno = ENOMEM;
+            return FALSE;
+        }
+        view->marks = m;
+        view->markCap *= 2;
+    }
+    view->marks[view->markCount++] = off;
+    return TRUE;
+}
+
+/*
+lineViewCreate returns a LineView of the length chars at text, such as a
+buffer from readFile or a view from readFileMapped.  Nothing is read or
+allocated for the lines until they are asked for, so looking at a few
+lines of a huge text, or a binary search of a sorted one, costs only the
+lines reached.  text must remain valid and unchanged until lineViewClose.
+A LineView may be used by one thread at a time.  Include readFile.h before
+calling any lineView function.
+ARGUMENTS
+---------
+  Inputs:
+	text		the text whose lines are wanted
+	length		the length of text in chars
+RETURN VALUE
+------------
+lineViewCreate returns a pointer to a new LineView or, if memory is
+exhausted, it sets errno and returns NULL.
+*/
+LineView *
+lineViewCreate(const char *text, size_t length)
+{
+    LineView *view = malloc(sizeof(*view));
+
+    if (!view) {
+        errno = ENOMEM;
+    } else if (!text && length) {
+        free(view);
+        view = NULL;
+        errno = EINVAL;
+    } else if (!(view->marks = malloc(16 * sizeof(*view->marks)))) {
+        free(view);
+        view = NULL;
+        errno = ENOMEM;
+    } else {
+        view->text = text;
+        view->length = length;
+        view->mapped = FALSE;
+        view->marks[0] = 0;
+        view->markCount = 1;
+        view->markCap = 16;
+        view->complete = FALSE;
+        view->lineCount = 0;
+        view->cursorLine = 0;
+        view->cursorOff = 0;
+    }
+
+    return view;
+}
+
+/*
+lineViewOpen maps the file named fileName with readFileMapped, limited by
+maxSize, and returns a LineView of it as lineViewCreate does.  The file is
+unmapped by lineViewClose.  lineViewOpen sets errno and returns NULL if an
+error occurs.
+*/
+LineView *
+lineViewOpen(const char *fileName, size_t maxSize)
+{
+    const char *text;
+    size_t length;
+    LineView *view = NULL;
+
+    if ((text = readFileMapped(fileName, maxSize, &length)) != NULL) {
+        if ((view = lineViewCreate(text, length)) != NULL)
+            view->mapped = TRUE;
+        else
+            freeFileMapped(text, length);
+    }
+
+    return view;
+}
+
+/*
+lineViewLine returns a pointer to line i (counting from 0) of view, the
+same line as readLines' lines[i], and stores its length in *length.  The
+line is not terminated: it is followed by its "\n" or "\r\n", or is at
+the end of the text.  The lines before i are found first if they haven't
+been, a block of LINE_VIEW_STRIDE lines at a time; after that, reaching
+line i takes counting at most LINE_VIEW_STRIDE lines, and reaching line
+i + 1 next takes one.  lineViewLine returns NULL, with *length set to 0,
+if there is no line i, with errno then set to 0, or if memory is
+exhausted.
+*/
+const char *
+lineViewLine(LineView *view, size_t i, size_t *length)
+{
+    size_t k = i / LINE_VIEW_STRIDE;
+    size_t line, off, end;
+
+    *length = 0;
+    while (!view->complete && k + 1 >= view->markCount)
+        if (!lineViewExtend(view))
+            return NULL;
+    if (view->complete && i >= view->lineCount) {
+        errno = 0;
+        return NULL;
+    }
+
+    // Count lines from the cursor if it's nearer than the checkpoint.
+    if (view->cursorLine <= i && view->cursorLine / LINE_VIEW_STRIDE == k) {
+        line = view->cursorLine;
+        off = view->cursorOff;
+    } else {
+        line = k * LINE_VIEW_STRIDE;
+        off = view->marks[k];
+    }
+    for (; line < i; ++line)
+        off = lineViewEnd(view, off) + 1;
+    view->cursorLine = i;
+    view->cursorOff = off;
+
+    end = lineViewEnd(view, off);
+    if (end < view->length && end > off && view->text[end-1] == '\r')
+        --end;      // "\r\n" ends the line
+    *length = end - off;
+    return view->text + off;
+}
+
+/*
+lineViewCount returns the number of lines in view, finding them all if
+they haven't been, or (size_t)-1 with errno set if memory is exhausted.
+*/
+size_t
+lineViewCount(LineView *view)
+{
+    while (!view->complete)
+        if (!lineViewExtend(view))
+            return (size_t)-1;
+    return view->lineCount;
+}
+
+/*
+lineViewClose frees view, and unmaps its text if lineViewOpen mapped it.
+A NULL view is acceptable and has no effect.
+*/
+void
+lineViewClose(LineView *view)
+{
+    if (view) {
+        if (view->mapped)
+            freeFileMapped(view->text, view->length);
+        free(view->marks);
+        free(view);
+    }
+}
+
+/*
+A LineReader holds the state of a file being read a chunk at a time by
+lineReaderNext.
+*/
+struct LineReader {
+    RfFile in;          // input file, or RF_NO_FILE
+    int isStdin;        // TRUE if in is the standard input, never closed
+    char *buf;          // window onto the file; one char spare for '\0'
+    size_t cap;         // size of buf less the spare char
+    size_t start;       // offset in buf of the next line
+    size_t scanned;     // offset in buf up to which no '\n' was found
+    size_t end;         // offset in buf of the end of the data
+    int eof;            // TRUE once the end of the file has been read
+};
+
+/*
+lineReaderOpen opens the text file named fileName for reading a line at a
+time with lineReaderNext.  Only a window of about chunkSize chars is kept in
+memory, so files of any size can be read.  The file is read as stored; a
+compressed file is not decompressed.  Include readFile.h before calling
+lineReaderOpen, lineReaderNext or lineReaderClose.
+ARGUMENTS
+---------
+  Inputs:
+	fileName    the name of the text file to read, or "-" for the standard input
+	chunkSize	the number of chars read from the file at a time.  The window
+				grows only if a line is longer than chunkSize.  If
+				chunkSize is zero then 64 KiB is used.
+RETURN VALUE
+------------
+lineReaderOpen returns a pointer to a new LineReader or, if an error occurs,
+it sets errno and returns NULL.  The caller should pass the LineReader to
+lineReaderClose when it is no longer needed.
+*/
+LineReader *
+lineReaderOpen(const char *fileName, size_t chunkSize)
+{
+    LineReader *r = NULL;
+
+    if (!fileName) {
+        errno = EINVAL;
+    } else if ((r = calloc(1, sizeof(*r)))) {
+        r->cap = chunkSize ? chunkSize : 64 * 1024;
+        r->isStdin = !strcmp(fileName, "-");
+        r->in = r->isStdin ? rfStdin() : rfOpen(fileName);
+        if (r->in == RF_NO_FILE || !(r->buf = malloc(r->cap + 1))) {
+            lineReaderClose(r);
+            r = NULL;
+        }
+    }
 
-#ifdef FALSE
-    #undef FALSE
-#endif
-#define FALSE 0
+    return r;
+}
 
 /*
-readFile reads the entire contents of the file named "fileName" into a
-newly-malloc'ed buffer and returns a pointer to the buffer.  Include
-readFile.h before calling readFile.
+lineReaderNext returns the next line of the file being read by reader.
+As in readLines, the line's terminating "\n" or "\r\n" is removed and the
+line is terminated with '\0'; the lines returned are those readLines would
+return, except that a compressed file is not decompressed even if
+readFile.c is compiled to decompress files.  The line is kept in reader's window and is valid only until the
+next call to lineReaderNext or lineReaderClose for reader.  A partial line
+at the end of the window is moved to the window's start before the next
+chunk is read into the rest of the window.
 ARGUMENTS
 ---------
   Inputs:
-	fileName    the name of the file to read
-	textMode    Read in text mode if non-zero, or in binary mode if zero.
-                If textMode is non-zero then "\r\n" is replaced by "\n" and
-                terminate is forced to TRUE.
-	terminate   If terminate is non-zero then a terminating '\0' is added after
-				the end of the file's contents in the buffer.
-	maxSize		If maxSize is non-zero its value sets a limit on the 
-				returned buffer size, measured in chars.  If maxSize is
-				non-zero and inadequate then errno is set to EFBIG and NULL
-				is returned.  If maxSize is zero then there is no limit.
-  Outputs:	
-	length      if length is non-NULL then the length of the data in chars
-				(excluding any added terminating '\0') is stored in *length.
+	reader		a pointer returned by lineReaderOpen
+  Outputs:
+	length      if length is non-NULL then the length of the line in chars
+				(excluding the terminating '\0') is stored in *length.
 RETURN VALUE
 ------------
-readFile returns a pointer to a newly malloc'ed data buffer or, if an error
-occurs, it sets errno and returns NULL.  The caller should free the returned
-buffer when it is no longer needed, even if *length is 0.
+lineReaderNext returns a pointer to the next line or, at the end of the file
+or if an error occurs, it returns NULL.  errno is set to 0 at the end of the
+file and to a non-zero value on error.
 */
 char *
-readFile(const char *fileName, int textMode, int terminate, size_t maxSize,
-		size_t *length)
+lineReaderNext(LineReader *reader, size_t *length)
 {
-	FILE *in;			// input file stream pointer
-	size_t fsize;		// file size
-	size_t n = 0;		// length in chars of the data as read from the file
-	char *buf = NULL;	// points to retrieved data
-    size_t t;           // space for terminating '\0'
-    int err = FALSE;
+    LineReader *r = reader;
+    char *line = NULL, *q;
+    size_t n = 0, want, got;
 
-	if (!fileName) {
-		errno = EINVAL;
-        err = TRUE;
-	} else {
-        if (textMode)
-            terminate = TRUE;
-		t = !!terminate;	// allowance for terminator if required
-		#ifdef _MSC_VER
-		  if (!fopen_s(&in, fileName, "rb") && in) {
-		#else
-		  if ((in = fopen(fileName, "rb"))) {
-		#endif
-			if (!fseek(in, 0, SEEK_END)) {
-				fsize = ftell(in);
-				if (!maxSize || (fsize + t) <= maxSize) {
-					buf = malloc(fsize + t);
-					if (buf) {
-                        errno = 0;  // per man page for rewind
-    					rewind(in);
-                        if (!errno) {
-                            n = fread(buf, 1, fsize, in);
-                            if (!ferror(in)) {
-                                if (terminate)
-                                    buf[n] = '\0';  // for strchr below
-                                if (textMode) {
-                                    char *s = strchr(buf, '\r');
-                                    if (s) {
-                                        char *d = s, *end = buf + n;
-                                        for (; s < end; ++s)
-                                            if (*s != '\r' || s[1] != '\n')
-                                                *d++ = *s;
-                                        n = d - buf;
-                                        if (terminate)
-                                            buf[n] = '\0';
-                                    }
-                                }
-                                if (n < fsize) {
-                                    char *b = realloc(buf, n + t);
-                                    if (b)
-                                        buf = b;
-                                    else
-                                        errno = 0; // let original buf be returned
-                                }
-                            } else
-                                err = TRUE; // note fread error
-                        } else
-                            err = TRUE;
-					}
-				} else {
-					errno = EFBIG;
-                    err = TRUE;
+    if (!r) {
+        errno = EINVAL;
+    } else {
+        for (;;) {
+            line = r->buf + r->start;
+            q = memchr(r->buf + r->scanned, '\n', r->end - r->scanned);
+            if (q) {
+                n = q - line;
+                // Only a '\r' just before a '\n' is removed in text mode.
+                if (n && line[n-1] == '\r')
+                    --n;
+                r->start = r->scanned = q + 1 - r->buf;
+                break;
+            }
+            r->scanned = r->end;
+            if (r->eof) {
+                if ((n = r->end - r->start)) {  // line with no '\n' at EOF
+                    r->start = r->end;
+                    break;
                 }
-			}
-			fclose(in);
-		}
-	}
+                errno = 0;
+                line = NULL;
+                break;
+            }
+            if (r->start) {     // move the partial line to the front
+                memmove(r->buf, line, r->end - r->start);
+                r->end -= r->start;
+                r->scanned = r->end;
+                r->start = 0;
+            }
+            if (r->end == r->cap) {     // line is longer than the window
+                char *b = realloc(r->buf, r->cap * 2 + 1);
+                if (!b) {
+                    line = NULL;
+                    break;
+                }
+                r->buf = b;
+                r->cap *= 2;
+            }
+            want = r->cap - r->end;
+            if ((got = rfRead(r->in, r->buf + r->end, want)) == (size_t)-1) {
+                line = NULL;
+                break;
+            }
+            r->end += got;
+            r->eof = got < want;    // rfRead stops short only at the end
+        }
+        if (line)
+            line[n] = '\0';
+    }
 
-	if (!buf || err) {
-		n = 0;
-		free(buf);
-		buf = NULL;
+    if (length)
+        *length = line ? n : 0;
+
+    return line;
+}
+
+/*
+lineReaderClose closes the file being read by reader and frees reader.
+ARGUMENTS
+---------
+  Inputs:
+	reader		a pointer returned by lineReaderOpen.  A NULL argument is
+				acceptable and has no effect.
+*/
+void
+lineReaderClose(LineReader *reader)
+{
+    if (reader) {
+        if (reader->in != RF_NO_FILE && !reader->isStdin)
+            rfClose(reader->in);
+        free(reader->buf);
+        free(reader);
     }
+}
 
-	if (length)
-		*length = n;
+/*
+A CacheEntry is a file held by a ReadFileCache.  file is what callers see;
+it must come first, since releaseCachedFile turns it back into its entry.
+An entry is identified by its name and kind and is valid while the file's
+device, inode, modification time and size match those recorded when it was
+read.  Entries are kept in a hash table and in an LRU list, the most
+recently used first.  refs counts the callers holding the entry, plus one
+while it is in the cache; it is freed when refs reaches 0.
+*/
+typedef struct CacheEntry {
+    CachedFile file;
+    char *name;
+    int kind;               // CACHE_BINARY, CACHE_TEXT or CACHE_LINES
+    uint64_t dev, ino, mtime, size;     // identity of the file when read
+    size_t bytes;           // memory charged to the cache's budget
+    size_t refs;
+    size_t hash;
+    struct CacheEntry *hnext;           // next in hash bucket
+    struct CacheEntry *prev, *next;     // LRU neighbors
+} CacheEntry;
 
-	return buf;
+enum { CACHE_BINARY, CACHE_TEXT, CACHE_LINES };
+
+struct ReadFileCache {
+    size_t budget;          // most bytes to keep, or 0 for no limit
+    size_t bytes;           // bytes held by the entries in the cache
+    size_t count;           // entries in the cache
+    size_t nBuckets;        // a power of 2
+    CacheEntry **buckets;
+    CacheEntry *head, *tail;            // LRU list
+    #ifndef READFILE_NO_THREADS
+      #ifdef _MSC_VER
+        SRWLOCK lock;
+      #else
+        pthread_mutex_t lock;
+      #endif
+    #endif
+};
+
+static void
+cacheLock(ReadFileCache *c)
+{
+    #ifndef READFILE_NO_THREADS
+      #ifdef _MSC_VER
+        AcquireSRWLockExclusive(&c->lock);
+      #else
+        pthread_mutex_lock(&c->lock);
+      #endif
+    #else
+      (void)c;
+    #endif
 }
 
+static void
+cacheUnlock(ReadFileCache *c)
+{
+    #ifndef READFILE_NO_THREADS
+      #ifdef _MSC_VER
+        ReleaseSRWLockExclusive(&c->lock);
+      #else
+        pthread_mutex_unlock(&c->lock);
+      #endif
+    #else
+      (void)c;
+    #endif
+}
 
 /*
-readLines reads the entire contents of the text file named fileName into a
-newly-malloc'ed buffer and returns an argv-like array of pointers to the
-lines found in the buffer.  Carriage returns and linefeeds are excluded
-from the lines.  Each line is terminated with '\0'.  Include readFile.h
-before calling readLines or freeLines.  The caller should call freeLines
-when the lines are no longer needed, even if *lineCount is 0.
+cacheIdentify stores the identity of the file named fileName in *e's dev,
+ino, mtime and size.  It returns TRUE on success or sets errno and returns
+FALSE.
+*/
+static int
+cacheIdentify(const char *fileName, CacheEntry *e)
+{
+    #ifdef _MSC_VER
+      WIN32_FILE_ATTRIBUTE_DATA a;
+      if (!GetFileAttributesExA(fileName, GetFileExInfoStandard, &a)) {
+          setErrnoWin();
+          return FALSE;
+      }
+      e->dev = e->ino = 0;  // a name can't be reused without a new mtime
+      e->mtime = (uint64_t)a.ftLastWriteTime.dwHighDateTime << 32 |
+              a.ftLastWriteTime.dwLowDateTime;
+      e->size = (uint64_t)a.nFileSizeHigh << 32 | a.nFileSizeLow;
+    #else
+      struct stat st;
+      if (stat(fileName, &st))
+          return FALSE;
+      e->dev = st.st_dev;
+      e->ino = st.st_ino;
+      e->mtime = (uint64_t)st.st_mtime * 1000000000;
+      #if defined(__APPLE__)
+        e->mtime += st.st_mtimespec.tv_nsec;
+      #elif defined(__linux__)
+        e->mtime += st.st_mtim.tv_nsec;
+      #endif
+      e->size = st.st_size;
+    #endif
+    return TRUE;
+}
+
+// cacheHash returns the FNV-1a hash of fileName and kind.
+static size_t
+cacheHash(const char *fileName, int kind)
+{
+    size_t h = (size_t)2166136261u;
+
+    while (*fileName)
+        h = (h ^ (unsigned char)*fileName++) * 16777619u;
+    return (h ^ kind) * 16777619u;
+}
+
+// cacheFreeEntry frees entry e and what it holds.
+static void
+cacheFreeEntry(CacheEntry *e)
+{
+    if (e->kind == CACHE_LINES)
+        freeLines((char **)e->file.lines);
+    else
+        free((char *)e->file.buf);
+    free(e->name);
+    free(e);
+}
+
+// cacheUnlink removes entry e from cache c, freeing it if no one holds it.
+static void
+cacheUnlink(ReadFileCache *c, CacheEntry *e)
+{
+    CacheEntry **pp = &c->buckets[e->hash & (c->nBuckets - 1)];
+
+    while (*pp != e)
+        pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        c->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        c->tail = e->prev;
+    c->bytes -= e->bytes;
+    --c->count;
+    if (!--e->refs)
+        cacheFreeEntry(e);
+}
+
+// cacheInsert adds entry e to cache c, then evicts least recently used
+// entries while c is over budget.  e itself is kept.
+static void
+cacheInsert(ReadFileCache *c, CacheEntry *e)
+{
+    CacheEntry **b, *x, *next;
+    size_t i;
+
+    if (c->count >= c->nBuckets &&
+            (b = calloc(c->nBuckets * 2, sizeof(*b)))) {  // else stay small
+        for (i = 0; i < c->nBuckets; ++i) {
+            for (x = c->buckets[i]; x; x = next) {
+                next = x->hnext;
+                x->hnext = b[x->hash & (c->nBuckets * 2 - 1)];
+                b[x->hash & (c->nBuckets * 2 - 1)] = x;
+            }
+        }
+        free(c->buckets);
+        c->buckets = b;
+        c->nBuckets *= 2;
+    }
+    b = &c->buckets[e->hash & (c->nBuckets - 1)];
+    e->hnext = *b;
+    *b = e;
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head)
+        c->head->prev = e;
+    else
+        c->tail = e;
+    c->head = e;
+    c->bytes += e->bytes;
+    ++c->count;
+    ++e->refs;      // the cache's reference
+    while (c->budget && c->bytes > c->budget && c->tail != e)
+        cacheUnlink(c, c->tail);
+}
+
+/*
+readFileCacheCreate returns a new, empty ReadFileCache that holds files
+read by readFileCached and readLinesCached, so that reading an unchanged
+file again costs one stat instead of a read and a split.  The cache may be
+used by several threads at once unless readFile.c is compiled with
+-DREADFILE_NO_THREADS.  Include readFile.h before calling the cache
+functions.
 ARGUMENTS
 ---------
   Inputs:
-	fileName    the name of the text file to read
-	maxSize		If maxSize is non-zero its value sets a limit on the 
-				total memory allocated by readLines, measured in chars.
-                If maxSize is non-zero and inadequate then errno is set to
-                EFBIG and NULL is returned.  If maxSize is zero then there
-                is no limit.
-  Outputs:	
-	lineCount   if lineCount is non-NULL then the number of lines is stored
-                in *lineCount.
+	budget		the most memory, in chars, for the cache's files and lines.
+				Least recently used files are dropped to stay within it,
+				though files still held by callers are freed only when
+				released.  A file larger than budget is still returned but
+				is dropped soon after.  If budget is 0 there is no limit.
 RETURN VALUE
 ------------
-readLines returns a pointer to an argv-like array of pointers to the lines or,
-if an error occurs, it sets errno and returns NULL.
-The returned line pointers are followed by a NULL pointer, similar to argv.
-NOTE: An address is hidden before the first entry in lines.  Don't change
-it or compensate in any way for it.
+readFileCacheCreate returns a pointer to the cache or, if memory is
+exhausted, it sets errno and returns NULL.  The caller should pass the
+cache to readFileCacheDestroy when it is no longer needed.
 */
-char **
-readLines(const char *fileName, size_t maxSize, size_t *lineCount)
+ReadFileCache *
+readFileCacheCreate(size_t budget)
 {
-    char *buf;                  // pointer to text returned by readFile
-    size_t length;              // length  of text returned by readFile
-    char *p;                    // scratch pointer
-    size_t lnCnt = 0;           // local line count
-    size_t linesSize;           // space required for line pointers
-    char **ln, **lines = NULL;  // argv-like array of lines found in fileName
-    
-    // Store the address of readFile's buf variable as a hidden line at lines'
-    // beginning.
-    buf = readFile(fileName, TRUE, TRUE, maxSize, &length);
-    if (buf) {
-        lnCnt = length && buf[length-1] != '\n'; // line with no '\n' at EOF
-        for (p = buf; (p = strchr(p, '\n')); ++p)
-            ++lnCnt;
-        linesSize = (lnCnt + 1+1) * sizeof(*lines); // 1+1: buf & NULL pointers
-        if (!maxSize || (linesSize+length+1) <= maxSize) {
-            if ( (lines = malloc(linesSize)) ) {
-                *lines++ = buf;    // save readFile buffer location
-                ln = lines;
-                if (length)
-                    for (*ln++ = p = buf; (p = strchr(p, '\n'));) {
-                        *p++ = '\0';
-                        if (*p)
-                            *ln++ = p;
-                    }
-                *ln = NULL;
-            }
-        } else {
-            errno = EFBIG;  // lines will be NULL so buf will be freed below
+    ReadFileCache *c = calloc(1, sizeof(*c));
+
+    if (c) {
+        c->budget = budget;
+        c->nBuckets = 64;
+        if (!(c->buckets = calloc(c->nBuckets, sizeof(*c->buckets)))) {
+            free(c);
+            return NULL;
         }
-        if (!lines) {
-            lnCnt = 0;
-            free(buf);
-            buf = NULL;
+        #ifndef READFILE_NO_THREADS
+          #ifdef _MSC_VER
+            InitializeSRWLock(&c->lock);
+          #else
+            pthread_mutex_init(&c->lock, NULL);
+          #endif
+        #endif
+    }
+    return c;
+}
+
+/*
+cacheGet returns the entry of kind for the file named fileName from cache
+c, holding it for the caller, after reading the file if it isn't cached or
+has changed since it was read.  cacheGet returns NULL with errno set on
+failure.
+*/
+static CacheEntry *
+cacheGet(ReadFileCache *c, const char *fileName, int kind)
+{
+    CacheEntry id, *e, *x;
+    size_t len;
+
+    if (!c || !fileName) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!cacheIdentify(fileName, &id))
+        return NULL;
+    id.hash = cacheHash(fileName, kind);
+
+    cacheLock(c);
+    for (e = c->buckets[id.hash & (c->nBuckets - 1)]; e; e = e->hnext)
+        if (e->hash == id.hash && e->kind == kind && !strcmp(e->name, fileName))
+            break;
+    if (e && e->dev == id.dev && e->ino == id.ino && e->mtime == id.mtime &&
+            e->size == id.size) {
+        ++e->refs;
+        if (e != c->head) {     // move to the front of the LRU list
+            e->prev->next = e->next;
+            if (e->next)
+                e->next->prev = e->prev;
+            else
+                c->tail = e->prev;
+            e->prev = NULL;
+            e->next = c->head;
+            c->head->prev = e;
+            c->head = e;
         }
-	}
+        cacheUnlock(c);
+        return e;
+    }
+    if (e)
+        cacheUnlink(c, e);      // stale
+    cacheUnlock(c);
 
-	if (lineCount)
-		*lineCount = lnCnt;
+    // Read without the lock, so other files can be served meanwhile.
+    len = strlen(fileName);
+    if (!(e = calloc(1, sizeof(*e))) || !(e->name = malloc(len + 1))) {
+        free(e);
+        return NULL;
+    }
+    memcpy(e->name, fileName, len + 1);
+    e->kind = kind;
+    e->dev = id.dev;
+    e->ino = id.ino;
+    e->mtime = id.mtime;
+    e->size = id.size;
+    e->hash = id.hash;
+    e->refs = 1;                // the caller's reference
+    if (kind == CACHE_LINES) {
+        char **lines = readLines(fileName, 0, &e->file.lineCount);
+        if (lines) {
+            e->file.lines = lines;
+            e->file.buf = lines[-1];
+            e->file.length = e->file.lineCount ?
+                lines[e->file.lineCount - 1] - lines[-1] +
+                strlen(lines[e->file.lineCount - 1]) + 1 : 0;
+            e->bytes = (e->file.lineCount + 2) * sizeof(*lines);
+        }
+    } else {
+        e->file.buf = readFile(fileName, kind == CACHE_TEXT, TRUE, 0,
+                &e->file.length);
+    }
+    if (!e->file.buf) {
+        free(e->name);
+        free(e);
+        return NULL;
+    }
+    e->bytes += sizeof(*e) + len + 1 + (kind == CACHE_LINES ?
+            (size_t)id.size : e->file.length) + 1;
 
-	return lines;
+    cacheLock(c);
+    for (x = c->buckets[id.hash & (c->nBuckets - 1)]; x; x = x->hnext)
+        if (x->hash == id.hash && x->kind == kind && !strcmp(x->name, fileName))
+            break;
+    if (x)                      // another thread read it meanwhile
+        cacheUnlink(c, x);
+    cacheInsert(c, e);
+    cacheUnlock(c);
+    return e;
 }
 
 /*
-freeLines frees memory allocated by readLines.
+readFileCached returns the contents of the file named fileName, read as
+readFile(fileName, textMode, TRUE, 0, &length) would, from cache.  The file
+is read only if it isn't in the cache or has changed (its device, inode,
+modification time or size differ) since it was read.  The returned
+CachedFile's buf and length are the contents and their length; its lines
+member is NULL.  The contents are shared and must not be changed.
 ARGUMENTS
 ---------
   Inputs:
-    lines   a pointer to lines allocated by readLines.  A NULL argument is
-            acceptable and has no effect.
+	cache		a pointer returned by readFileCacheCreate
+	fileName    the name of the file to read
+	textMode    as for readFile
+RETURN VALUE
+------------
+readFileCached returns a pointer to the CachedFile or, if an error occurs,
+it sets errno and returns NULL.  The caller should pass the pointer to
+releaseCachedFile when it is no longer needed.
+*/
+const CachedFile *
+readFileCached(ReadFileCache *cache, const char *fileName, int textMode)
+{
+    CacheEntry *e = cacheGet(cache, fileName, textMode ? CACHE_TEXT :
+            CACHE_BINARY);
+
+    return e ? &e->file : NULL;
+}
+
+/*
+readLinesCached returns the lines of the file named fileName, read as
+readLines would, from cache, as readFileCached does.  The returned
+CachedFile's lines and lineCount are as readLines returns and stores; its
+buf is the text the lines point into, and length is the number of chars the
+lines take there, counting each line's '\0'.  The lines are shared and
+must not be changed.  The caller should pass the pointer to
+releaseCachedFile when it is no longer needed.
+*/
+const CachedFile *
+readLinesCached(ReadFileCache *cache, const char *fileName)
+{
+    CacheEntry *e = cacheGet(cache, fileName, CACHE_LINES);
+
+    return e ? &e->file : NULL;
+}
+
+/*
+releaseCachedFile releases file, returned by readFileCached or
+readLinesCached from cache.  file and what it points to must not be used
+afterward.  A NULL file is acceptable and has no effect.
 */
 void
-freeLines(char **lines)
+releaseCachedFile(ReadFileCache *cache, const CachedFile *file)
 {
-    if (lines) {
-        --lines;
-        free(*lines);
-        free(lines);
+    CacheEntry *e = (CacheEntry *)file;
+
+    if (cache && e) {
+        cacheLock(cache);
+        if (!--e->refs)
+            cacheFreeEntry(e);  // dropped from the cache while held
+        cacheUnlock(cache);
+    }
+}
+
+/*
+readFileCacheDestroy frees cache and the files in it.  Files still held by
+callers must be released before.  A NULL cache is acceptable and has no
+effect.
+*/
+void
+readFileCacheDestroy(ReadFileCache *cache)
+{
+    if (cache) {
+        while (cache->head)
+            cacheUnlink(cache, cache->head);
+        #ifndef READFILE_NO_THREADS
+          #ifndef _MSC_VER
+            pthread_mutex_destroy(&cache->lock);
+          #endif
+        #endif
+        free(cache->buckets);
+        free(cache);
     }
 }
 
@@ -301,3 +5376,368 @@ main(int argc, char *argv[])
 #endif
 
 #endif
+
+#ifdef READFILE_BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Benchmark readFile and readLines on synthetic corpora.  Compile with, e.g.,
+	cc -O2 -DREADFILE_BENCH readFile.c -o readFileBench -pthread
+and run
+	readFileBench [-s MB[,MB...]] [-r reps] [-d dir] [-k] [-t]
+Each corpus is written to dir (default ".") in each size (default 1 and 64
+MB), read reps times (default 5) per case, and deleted unless -k is given.
+The corpora vary line length, CRLF density and the share of empty lines,
+and are generated from a fixed seed, so every run reads the same bytes.
+For each file, readFile in binary mode, readFile in text mode and readLines
+are timed warm (file in the page cache, after one untimed read) and cold
+(cache evicted before each read with posix_fadvise where it is available),
+and the median rate is reported in MB/s and millions of lines/s.  Cold
+timings are approximate: the OS may keep or prefetch pages regardless.
+With -t the benchmark instead calibrates readFileAuto and readLinesAuto
+(see benchTune) on sizes up to 1 GB, or those given with -s, and prints the
+readFileSetTuning call that suits this machine.
+*/
+
+typedef struct BenchCorpus {
+    const char *name;
+    size_t lineLen;     // average line length; 0 for no line ends at all
+    int crlf;           // percentage of line ends that are "\r\n"
+    int empty;          // percentage of lines that are empty
+} BenchCorpus;
+
+static const BenchCorpus benchCorpora[] = {
+    { "short-lf",     8,    0,   0 },
+    { "short-crlf",   8,    100, 0 },
+    { "medium-lf",    80,   0,   0 },
+    { "medium-crlf",  80,   100, 0 },
+    { "medium-mixed", 80,   50,  0 },
+    { "medium-empty", 80,   0,   30 },
+    { "long-lf",      1000, 0,   0 },
+    { "long-crlf",    1000, 100, 0 },
+    { "no-lines",     0,    0,   0 },
+};
+
+static unsigned long long benchSeed;
+
+// benchRand returns the next number of a fixed xorshift64* sequence.
+static unsigned long long
+benchRand(void)
+{
+    benchSeed ^= benchSeed >> 12;
+    benchSeed ^= benchSeed << 25;
+    benchSeed ^= benchSeed >> 27;
+    return benchSeed * 0x2545F4914F6CDD1DULL;
+}
+
+// benchWrite writes size bytes of corpus c to fileName; it returns TRUE
+// on success.
+static int
+benchWrite(const char *fileName, const BenchCorpus *c, size_t size)
+{
+    FILE *f;
+    char *buf;
+    size_t n = 0, len, i;
+    int ok;
+
+    if (!(buf = malloc(size + 2)))
+        return FALSE;
+    benchSeed = 0x9E3779B97F4A7C15ULL;
+    while (n < size) {
+        len = !c->lineLen ? size :
+            (int)(benchRand() % 100) < c->empty ? 0 :
+            1 + benchRand() % (2 * c->lineLen - 1);
+        for (i = 0; i < len && n < size; ++i)
+            buf[n++] = 'a' + benchRand() % 26;
+        if (c->lineLen && n < size) {
+            if ((int)(benchRand() % 100) < c->crlf)
+                buf[n++] = '\r';
+            buf[n++] = '\n';
+        }
+    }
+    #ifdef _MSC_VER
+      if (fopen_s(&f, fileName, "wb"))
+          f = NULL;
+    #else
+      f = fopen(fileName, "wb");
+    #endif
+    ok = f && fwrite(buf, 1, n, f) == n;
+    if (f)
+        ok = !fclose(f) && ok;
+    free(buf);
+    #ifdef POSIX_FADV_DONTNEED
+      if (ok) {     // write dirty pages now so they can be evicted later
+          int fd = open(fileName, O_RDONLY);
+          if (fd >= 0) {
+              fsync(fd);
+              close(fd);
+          }
+      }
+    #endif
+    return ok;
+}
+
+// benchEvict asks the OS to drop fileName from its page cache; it returns
+// TRUE if it could ask.
+static int
+benchEvict(const char *fileName)
+{
+    #ifdef POSIX_FADV_DONTNEED
+      int fd = open(fileName, O_RDONLY);
+      int ok = fd >= 0 && !posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      if (fd >= 0)
+          close(fd);
+      return ok;
+    #else
+      (void)fileName;
+      return FALSE;
+    #endif
+}
+
+// benchNow returns a monotonic time in seconds.
+static double
+benchNow(void)
+{
+    #ifdef _MSC_VER
+      LARGE_INTEGER t, f;
+      QueryPerformanceCounter(&t);
+      QueryPerformanceFrequency(&f);
+      return (double)t.QuadPart / f.QuadPart;
+    #else
+      struct timespec t;
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      return t.tv_sec + t.tv_nsec * 1e-9;
+    #endif
+}
+
+// benchRun reads fileName once by method m and returns the seconds taken,
+// or a negative number on error.  Methods 0 to 2 are readFile in binary and
+// text modes and readLines; 3 to 5 are readFileDirect in both modes and
+// readLinesParallel.
+static double
+benchRun(const char *fileName, int m)
+{
+    double t = benchNow();
+    size_t n;
+    char *buf = NULL;
+    char **lines = NULL;
+
+    if (m < 2)
+        buf = readFile(fileName, m, m, 0, &n);
+    else if (m == 2)
+        lines = readLines(fileName, 0, &n);
+    else if (m < 5)
+        buf = readFileDirect(fileName, m - 3, m - 3, 0, &n);
+    else
+        lines = readLinesParallel(fileName, 0, 0, &n);
+    t = benchNow() - t;
+    if (!buf && !lines)
+        return -1;
+    free(buf);
+    freeLines(lines);
+    return t;
+}
+
+static int
+benchCompare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// benchMedian times reps reads of fileName by method m, evicting the file
+// from the cache before each if cold, and returns the median seconds or a
+// negative number on error.
+static double
+benchMedian(const char *fileName, int m, int cold, double *times, int reps)
+{
+    int i;
+
+    if (!cold && benchRun(fileName, m) < 0)     // warm the cache
+        return -1;
+    for (i = 0; i < reps; ++i) {
+        if (cold && !benchEvict(fileName))
+            return -1;
+        if ((times[i] = benchRun(fileName, m)) < 0)
+            return -1;
+    }
+    qsort(times, reps, sizeof(*times), benchCompare);
+    return times[reps / 2];
+}
+
+/*
+benchTune times, on the medium-crlf corpus in each of the nSizes sizes
+(ascending, in MB), each way readFileAuto and readLinesAuto may read a file
+against the way readFile and readLines read it: readFileDirect cold, in
+binary and text modes, and readLinesParallel warm.  Each ReadFileTuning
+size is set to the smallest size from which the other way was faster at
+every size, or to 0 if it never was, and the readFileSetTuning call that
+sets them is printed.  A size whose other way can't be timed (cold timings
+need posix_fadvise) is left at its default.  benchTune returns 0, or 1 if
+a corpus can't be written.
+*/
+static int
+benchTune(const char *dir, const size_t *sizes, int nSizes, double *times,
+        int reps)
+{
+    static const int pairs[3][3] = {   // usual method, other method, cold
+        { 0, 3, TRUE }, { 1, 4, TRUE }, { 2, 5, FALSE } };
+    static const char *fields[3] = { "directMin", "directTextMin",
+            "parallelMin" };
+    ReadFileTuning tn;
+    size_t found[3] = { 0, 0, 0 }, *field[3];
+    char fileName[4096];
+    double usual, other;
+    int i, p, timed[3] = { TRUE, TRUE, TRUE }, lost[3] = { 0, 0, 0 };
+
+    for (i = nSizes - 1; i >= 0; --i) {
+        snprintf(fileName, sizeof(fileName), "%s/rfbench-tune-%zuM.txt",
+                dir, sizes[i]);
+        if (!benchWrite(fileName, &benchCorpora[3], sizes[i] << 20)) {
+            fprintf(stderr, "writing \"%s\": ", fileName);
+            perror(NULL);
+            return 1;
+        }
+        for (p = 0; p < 3; ++p) {
+            if (!timed[p] || lost[p])
+                continue;   // lost at a larger size, so no smaller one counts
+            usual = benchMedian(fileName, pairs[p][0], pairs[p][2], times,
+                    reps);
+            other = benchMedian(fileName, pairs[p][1], pairs[p][2], times,
+                    reps);
+            if (usual < 0 || other < 0) {
+                timed[p] = FALSE;
+                continue;
+            }
+            printf("%6zu MB %-13s %10.2f ms usual %10.2f ms other\n",
+                    sizes[i], fields[p], usual * 1e3, other * 1e3);
+            fflush(stdout);
+            if (other < usual)
+                found[p] = sizes[i] << 20;
+            else
+                lost[p] = TRUE;
+        }
+        remove(fileName);
+    }
+
+    readFileGetTuning(&tn);
+    field[0] = &tn.directMin;
+    field[1] = &tn.directTextMin;
+    field[2] = &tn.parallelMin;
+    printf("\nReadFileTuning tuning = {\n");
+    for (p = 0; p < 3; ++p) {
+        if (timed[p])
+            *field[p] = found[p];
+        printf("    (size_t)%-5zu << 20,  // %s%s\n", *field[p] >> 20,
+                fields[p], timed[p] ? "" : " (default; not timed)");
+    }
+    printf("};\nreadFileSetTuning(&tuning);\n");
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *methods[] = { "readFile binary", "readFile text",
+            "readLines" };
+    const char *sizes = "1,64", *dir = ".", *s;
+    char fileName[4096];
+    double *times, t, mb;
+    size_t mbytes, lineCount, c;
+    char **lines, *end;
+    size_t tuneSizes[32];
+    int reps = 5, keep = FALSE, tune = FALSE, nSizes = 0, i, m, cold;
+    int status = 0;
+
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            sizes = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            dir = argv[++i];
+        else if (!strcmp(argv[i], "-k"))
+            keep = TRUE;
+        else if (!strcmp(argv[i], "-t"))
+            tune = TRUE;
+        else
+            reps = 0;
+    }
+    if (reps < 1) {
+        fprintf(stderr,
+                "Usage: %s [-s MB[,MB...]] [-r reps] [-d dir] [-k] [-t]\n",
+                argv[0]);
+        return 1;
+    }
+    if (!(times = malloc(reps * sizeof(*times)))) {
+        perror(argv[0]);
+        return 1;
+    }
+    if (tune) {
+        if (!strcmp(sizes, "1,64"))
+            sizes = "1,4,16,64,256,1024";
+        for (s = sizes; *s && nSizes < 32; s = *end ? end + 1 : end) {
+            mbytes = strtoul(s, &end, 10);
+            if (end == s || !mbytes)
+                break;
+            for (i = nSizes++; i > 0 && tuneSizes[i - 1] > mbytes; --i)
+                tuneSizes[i] = tuneSizes[i - 1];
+            tuneSizes[i] = mbytes;
+        }
+        status = benchTune(dir, tuneSizes, nSizes, times, reps);
+        free(times);
+        return status;
+    }
+
+    printf("%-13s %6s %-16s %10s %10s %10s %10s\n", "corpus", "MB",
+            "method", "warm MB/s", "warm Ml/s", "cold MB/s", "cold Ml/s");
+    for (s = sizes; *s; s = *end ? end + 1 : end) {
+        mbytes = strtoul(s, &end, 10);
+        if (end == s || !mbytes)
+            break;
+        for (c = 0; c < sizeof(benchCorpora) / sizeof(*benchCorpora); ++c) {
+            snprintf(fileName, sizeof(fileName), "%s/rfbench-%s-%zuM.txt",
+                    dir, benchCorpora[c].name, mbytes);
+            if (!benchWrite(fileName, &benchCorpora[c], mbytes << 20) ||
+                    !(lines = readLines(fileName, 0, &lineCount))) {
+                fprintf(stderr, "%s: writing \"%s\": ", argv[0], fileName);
+                perror(NULL);
+                status = 1;
+                break;
+            }
+            freeLines(lines);
+            mb = (double)(mbytes << 20) / 1e6;
+            for (m = 0; m < 3; ++m) {
+                printf("%-13s %6zu %-16s", benchCorpora[c].name, mbytes,
+                        methods[m]);
+                for (cold = 0; cold < 2; ++cold) {
+                    t = benchMedian(fileName, m, cold, times, reps);
+                    if (t > 0)
+                        printf(" %10.1f %10.2f", mb / t, lineCount / t / 1e6);
+                    else
+                        printf(" %10s %10s", "-", "-");
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+            if (!keep)
+                remove(fileName);
+        }
+    }
+
+    free(times);
+    return status;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
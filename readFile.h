@@ -10,6 +10,7 @@
 #ifndef READALLFILE_H_
 #define READALLFILE_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -19,8 +20,168 @@ extern "C" {
 char *readFile(const char *filename, int modeBinary, int terminate, size_t maxsize,
 		size_t *length);
 
+// A ReadFileAllocator routes the memory of the *Ex functions through the
+// caller's functions.  Each is passed context.
+typedef struct ReadFileAllocator {
+	void *(*allocate)(void *context, size_t size);
+	void *(*reallocate)(void *context, void *p, size_t oldSize,
+			size_t newSize);
+	void (*deallocate)(void *context, void *p);
+	void *context;
+} ReadFileAllocator;
+
+// A ReadFileStatus tells how a *StatusEx call went.  Data is returned only
+// for READFILE_OK and READFILE_SHORT_READ.
+typedef enum ReadFileStatus {
+	READFILE_OK,			// the whole file was read
+	READFILE_SHORT_READ,	// the file shrank while it was read
+	READFILE_BAD_ARGUMENT,	// e.g. a NULL file name
+	READFILE_OPEN_FAILED,	// the file couldn't be opened or examined
+	READFILE_TOO_BIG,		// the file is larger than maxSize allows
+	READFILE_READ_FAILED,	// an I/O error occurred while reading
+	READFILE_NO_MEMORY		// memory couldn't be allocated
+} ReadFileStatus;
+
+char *readFileEx(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length, const ReadFileAllocator *allocator);
+ReadFileStatus readFileStatusEx(const char *fileName, int textMode,
+		int terminate, size_t maxSize, const ReadFileAllocator *allocator,
+		char **buf, size_t *length);
+const char *readFileStatusString(ReadFileStatus status);
+char *readFileInto(const char *fileName, int textMode, int terminate,
+		char **buf, size_t *capacity, size_t *length);
+char *readFileUtf8(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length, size_t *invalidOffset);
+char *readFileDirect(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length);
+// readFileRange and readLinesRange read the chars stored in the file; a
+// compressed file is not decompressed.
+char *readFileRange(const char *fileName, size_t offset, size_t length,
+		int textMode, int terminate, size_t *outLen);
+
+// A ReadFileStats records where the time of a readFileWithStats or
+// readLinesWithStats call went.
+typedef struct ReadFileStats {
+	uint64_t openNs;		// opening, sizing and closing the file
+	uint64_t readNs;		// allocating the buffer and reading the file
+	uint64_t crlfNs;		// removing carriage returns (readFile text mode)
+	uint64_t splitNs;		// removing CRs and finding lines (readLines)
+	uint64_t shrinkNs;		// reallocating the buffer to fit the data
+	size_t bytesRead;		// chars read from the file
+	size_t crsRemoved;		// carriage returns removed
+	size_t lines;			// lines found (readLines)
+	int shrunk;				// TRUE if the buffer was reallocated to fit
+} ReadFileStats;
+
+char *readFileWithStats(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length, ReadFileStats *stats);
+
+// A ReadFileResult is what readFiles stores for each file it reads.
+typedef struct ReadFileResult {
+	char *buf;			// as readFile returns, or NULL on error
+	size_t length;		// length of the data in chars
+	int error;			// 0, or the errno value for the failure
+	ReadFileStatus status;	// as readFileStatusEx returns
+} ReadFileResult;
+
+size_t readFiles(const char *const *fileNames, size_t n, int textMode,
+		int terminate, size_t maxSize, size_t nThreads,
+		ReadFileResult *results);
+char **readLinesMulti(const char *const *fileNames, size_t n, size_t maxSize,
+		size_t nThreads, size_t *lineCount, size_t *firstLines);
+
+// A ReadFileCallback receives the result of a readFileAsync call.
+typedef void (*ReadFileCallback)(char *buf, size_t length, int error,
+		void *userData);
+
+int readFileAsync(const char *fileName, int textMode, int terminate,
+		size_t maxSize, ReadFileCallback callback, void *userData);
+
 char **readLines(const char *fileName, size_t maxSize, size_t *lineCount);
+char **readLinesWithLengths(const char *fileName, size_t maxSize,
+		size_t *lineCount, size_t **lengths);
+char **readLinesWithStats(const char *fileName, size_t maxSize,
+		size_t *lineCount, ReadFileStats *stats);
 void freeLines(char **lines);
+char **readLinesEx(const char *fileName, size_t maxSize, size_t *lineCount,
+		size_t **lengths, const ReadFileAllocator *allocator);
+ReadFileStatus readLinesStatusEx(const char *fileName, size_t maxSize,
+		const ReadFileAllocator *allocator, char ***lines, size_t *lineCount);
+char **readRecords(const char *fileName, const char *delimiter,
+		size_t delimiterLength, size_t recordSize, size_t maxSize,
+		size_t *recordCount, size_t **lengths);
+void freeLinesEx(char **lines, const ReadFileAllocator *allocator);
+char **readLinesInto(const char *fileName, size_t maxSize, char ***lines,
+		size_t *linesCapacity, size_t *textCapacity, size_t *lineCount);
+char **readLinesRange(const char *fileName, size_t offset, size_t length,
+		size_t maxSize, size_t *lineCount);
+char **readLinesParallel(const char *fileName, size_t maxSize,
+		size_t nThreads, size_t *lineCount);
+
+typedef struct LineIndex {
+	char *buf;				// the text; each line is terminated by '\0'
+	size_t length;			// length of the text in chars
+	size_t lineCount;		// number of lines
+	int wide;				// non-zero if offsets are uint64_t, else uint32_t
+	const void *offsets;	// lineCount+1 line start offsets into buf
+} LineIndex;
+
+LineIndex *readLinesIndex(const char *fileName, size_t maxSize);
+const char *lineIndexLine(const LineIndex *index, size_t i);
+size_t lineIndexLength(const LineIndex *index, size_t i);
+void freeLineIndex(LineIndex *index);
+
+const char *readFileMapped(const char *fileName, size_t maxSize,
+		size_t *length);
+void freeFileMapped(const char *view, size_t length);
+
+// A ReadFileTuning holds the file sizes, in chars, at which readFileAuto
+// and readLinesAuto switch from one way of reading to another.  0 turns a
+// way off.
+typedef struct ReadFileTuning {
+	size_t directMin;		// direct I/O for uncached local files this big
+	size_t directTextMin;	// the same in text mode and for readLinesAuto
+	size_t parallelMin;		// readLinesAuto splits cached files this big
+							// on every processor
+} ReadFileTuning;
+
+void readFileSetTuning(const ReadFileTuning *tuning);
+void readFileGetTuning(ReadFileTuning *tuning);
+char *readFileAuto(const char *fileName, int textMode, int terminate,
+		size_t maxSize, size_t *length);
+char **readLinesAuto(const char *fileName, size_t maxSize, size_t *lineCount);
+
+typedef struct LineView LineView;
+LineView *lineViewCreate(const char *text, size_t length);
+LineView *lineViewOpen(const char *fileName, size_t maxSize);
+const char *lineViewLine(LineView *view, size_t i, size_t *length);
+size_t lineViewCount(LineView *view);
+void lineViewClose(LineView *view);
+
+// A LineReader reads the file as stored; a compressed file is not
+// decompressed.
+typedef struct LineReader LineReader;
+LineReader *lineReaderOpen(const char *fileName, size_t chunkSize);
+char *lineReaderNext(LineReader *reader, size_t *length);
+void lineReaderClose(LineReader *reader);
+
+// A ReadFileCache holds files for readFileCached and readLinesCached.
+typedef struct ReadFileCache ReadFileCache;
+
+// A CachedFile is a file's shared, read-only contents from a ReadFileCache.
+typedef struct CachedFile {
+	const char *buf;		// the contents, '\0'-terminated
+	size_t length;			// length of the contents in chars
+	char *const *lines;		// the lines, from readLinesCached; else NULL
+	size_t lineCount;		// number of lines
+} CachedFile;
+
+ReadFileCache *readFileCacheCreate(size_t budget);
+const CachedFile *readFileCached(ReadFileCache *cache, const char *fileName,
+		int textMode);
+const CachedFile *readLinesCached(ReadFileCache *cache, const char *fileName);
+void releaseCachedFile(ReadFileCache *cache, const CachedFile *file);
+void readFileCacheDestroy(ReadFileCache *cache);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,428 @@
+// readFile.hpp - C++17 wrappers for readFile.c.
+//
+// This file is public domain.  Public domain is per CC0 1.0; see
+// https://creativecommons.org/publicdomain/zero/1.0/ for information.
+//
+// FileBuffer and Lines own what readFile and readLines return and free it
+// when destroyed.  Both are move-only.  Lines are std::string_views made
+// from the lengths readLinesWithLengths returns, so nothing is copied and
+// strlen is never called.  The functions throw std::system_error on error,
+// or store it in a std::error_code when passed one.  Passing a
+// std::pmr::memory_resource gets all the memory from it.  Compile
+// readFile.c as C and link it in as usual.
+
+#ifndef READFILE_HPP_
+#define READFILE_HPP_
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <string_view>
+#include <system_error>
+#if __cplusplus >= 202002L && __has_include(<span>)
+	#include <span>
+#endif
+
+#include "readFile.h"
+
+namespace readfile {
+
+namespace detail {
+
+// The pmr functions keep each block's size just before it, since
+// ReadFileAllocator's deallocate isn't told the size.
+constexpr std::size_t pmrHead = alignof(std::max_align_t);
+
+inline void *
+pmrAllocate(void *context, std::size_t size) noexcept
+{
+	auto *mr = static_cast<std::pmr::memory_resource *>(context);
+	char *p;
+
+	try {
+		p = static_cast<char *>(mr->allocate(size + pmrHead, pmrHead));
+	} catch (...) {
+		return nullptr;		// readFile.c sets errno to ENOMEM
+	}
+	std::memcpy(p, &size, sizeof(size));
+	return p + pmrHead;
+}
+
+inline void
+pmrDeallocate(void *context, void *p) noexcept
+{
+	if (p) {
+		char *base = static_cast<char *>(p) - pmrHead;
+		std::size_t size;
+		std::memcpy(&size, base, sizeof(size));
+		static_cast<std::pmr::memory_resource *>(context)->deallocate(base,
+				size + pmrHead, pmrHead);
+	}
+}
+
+inline void *
+pmrReallocate(void *context, void *p, std::size_t oldSize,
+		std::size_t newSize) noexcept
+{
+	void *q = pmrAllocate(context, newSize);
+
+	if (q && p) {
+		std::memcpy(q, p, oldSize < newSize ? oldSize : newSize);
+		pmrDeallocate(context, p);
+	}
+	return q;
+}
+
+inline ReadFileAllocator
+pmrAllocator(std::pmr::memory_resource *mr) noexcept
+{
+	return ReadFileAllocator{pmrAllocate, pmrReallocate, pmrDeallocate, mr};
+}
+
+// error returns the error that errno reports, or EIO if errno is 0.
+inline std::error_code
+error() noexcept
+{
+	return std::error_code(errno ? errno : EIO, std::generic_category());
+}
+
+}	// namespace detail
+
+// A FileBuffer owns the contents of a file, terminated by a '\0' that
+// size() doesn't count.
+class FileBuffer {
+public:
+	FileBuffer() noexcept = default;
+	FileBuffer(const FileBuffer &) = delete;
+	FileBuffer &operator=(const FileBuffer &) = delete;
+
+	FileBuffer(FileBuffer &&other) noexcept
+		: buf_(other.buf_), size_(other.size_), alloc_(other.alloc_),
+		  custom_(other.custom_)
+	{
+		other.buf_ = nullptr;
+		other.size_ = 0;
+	}
+
+	FileBuffer &
+	operator=(FileBuffer &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			buf_ = other.buf_;
+			size_ = other.size_;
+			alloc_ = other.alloc_;
+			custom_ = other.custom_;
+			other.buf_ = nullptr;
+			other.size_ = 0;
+		}
+		return *this;
+	}
+
+	~FileBuffer() { reset(); }
+
+	const char *data() const noexcept { return buf_; }
+	std::size_t size() const noexcept { return size_; }
+	bool empty() const noexcept { return size_ == 0; }
+	const char *begin() const noexcept { return buf_; }
+	const char *end() const noexcept { return buf_ + size_; }
+	std::string_view view() const noexcept { return {buf_, size_}; }
+#if __cplusplus >= 202002L && __has_include(<span>)
+	std::span<const char> span() const noexcept { return {buf_, size_}; }
+#endif
+
+	// release gives up the buffer, which the caller must then free as
+	// readFile's (or readFileEx's, for a memory_resource) is freed.
+	char *
+	release() noexcept
+	{
+		char *p = buf_;
+		buf_ = nullptr;
+		size_ = 0;
+		return p;
+	}
+
+private:
+	char *buf_ = nullptr;
+	std::size_t size_ = 0;
+	ReadFileAllocator alloc_{};
+	bool custom_ = false;		// true if alloc_ frees buf_
+
+	FileBuffer(char *buf, std::size_t size, const ReadFileAllocator *alloc)
+			noexcept
+		: buf_(buf), size_(size), alloc_(alloc ? *alloc : ReadFileAllocator{}),
+		  custom_(alloc != nullptr) {}
+
+	void
+	reset() noexcept
+	{
+		if (custom_)
+			alloc_.deallocate(alloc_.context, buf_);
+		else
+			std::free(buf_);
+		buf_ = nullptr;
+		size_ = 0;
+	}
+
+	friend FileBuffer readFile(const char *, std::error_code &, bool,
+			std::size_t, std::pmr::memory_resource *) noexcept;
+};
+
+// Lines owns the lines of a text file, as readLines returns them.
+class Lines {
+public:
+	// An iterator yields the lines as std::string_views.
+	class iterator {
+	public:
+		// reference is not a true reference, so C++17 algorithms may
+		// only count on an input iterator; C++20 ones see the rest.
+		using iterator_category = std::input_iterator_tag;
+		using iterator_concept = std::random_access_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = std::string_view;
+
+		iterator() noexcept = default;
+		std::string_view operator*() const noexcept { return (*lines_)[i_]; }
+		std::string_view
+		operator[](difference_type n) const noexcept
+		{
+			return (*lines_)[i_ + n];
+		}
+		iterator &operator++() noexcept { ++i_; return *this; }
+		iterator
+		operator++(int) noexcept
+		{
+			iterator t = *this;
+			++i_;
+			return t;
+		}
+		iterator &operator--() noexcept { --i_; return *this; }
+		iterator
+		operator--(int) noexcept
+		{
+			iterator t = *this;
+			--i_;
+			return t;
+		}
+		iterator &
+		operator+=(difference_type n) noexcept
+		{
+			i_ += n;
+			return *this;
+		}
+		iterator &
+		operator-=(difference_type n) noexcept
+		{
+			i_ -= n;
+			return *this;
+		}
+		friend iterator
+		operator+(iterator it, difference_type n) noexcept
+		{
+			return it += n;
+		}
+		friend iterator
+		operator+(difference_type n, iterator it) noexcept
+		{
+			return it += n;
+		}
+		friend iterator
+		operator-(iterator it, difference_type n) noexcept
+		{
+			return it -= n;
+		}
+		friend difference_type
+		operator-(iterator a, iterator b) noexcept
+		{
+			return static_cast<difference_type>(a.i_ - b.i_);
+		}
+		friend bool
+		operator==(iterator a, iterator b) noexcept
+		{
+			return a.i_ == b.i_;
+		}
+		friend bool
+		operator!=(iterator a, iterator b) noexcept
+		{
+			return a.i_ != b.i_;
+		}
+		friend bool
+		operator<(iterator a, iterator b) noexcept
+		{
+			return a.i_ < b.i_;
+		}
+		friend bool
+		operator>(iterator a, iterator b) noexcept
+		{
+			return a.i_ > b.i_;
+		}
+		friend bool
+		operator<=(iterator a, iterator b) noexcept
+		{
+			return a.i_ <= b.i_;
+		}
+		friend bool
+		operator>=(iterator a, iterator b) noexcept
+		{
+			return a.i_ >= b.i_;
+		}
+
+	private:
+		const Lines *lines_ = nullptr;
+		std::size_t i_ = 0;
+
+		iterator(const Lines *lines, std::size_t i) noexcept
+			: lines_(lines), i_(i) {}
+		friend class Lines;
+	};
+
+	Lines() noexcept = default;
+	Lines(const Lines &) = delete;
+	Lines &operator=(const Lines &) = delete;
+
+	Lines(Lines &&other) noexcept
+		: lines_(other.lines_), lengths_(other.lengths_),
+		  count_(other.count_), alloc_(other.alloc_), custom_(other.custom_)
+	{
+		other.lines_ = nullptr;
+		other.lengths_ = nullptr;
+		other.count_ = 0;
+	}
+
+	Lines &
+	operator=(Lines &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			lines_ = other.lines_;
+			lengths_ = other.lengths_;
+			count_ = other.count_;
+			alloc_ = other.alloc_;
+			custom_ = other.custom_;
+			other.lines_ = nullptr;
+			other.lengths_ = nullptr;
+			other.count_ = 0;
+		}
+		return *this;
+	}
+
+	~Lines() { reset(); }
+
+	std::size_t size() const noexcept { return count_; }
+	bool empty() const noexcept { return count_ == 0; }
+	std::string_view
+	operator[](std::size_t i) const noexcept
+	{
+		return {lines_[i], lengths_[i]};
+	}
+	std::string_view front() const noexcept { return (*this)[0]; }
+	std::string_view back() const noexcept { return (*this)[count_ - 1]; }
+	iterator begin() const noexcept { return iterator(this, 0); }
+	iterator end() const noexcept { return iterator(this, count_); }
+
+	// data returns the '\0'-terminated lines as readLines returns them,
+	// followed by a NULL, or NULL if this Lines holds no file's lines (as
+	// after a move).  An empty file's array holds just the NULL.
+	char *const *data() const noexcept { return lines_; }
+
+private:
+	char **lines_ = nullptr;
+	std::size_t *lengths_ = nullptr;
+	std::size_t count_ = 0;
+	ReadFileAllocator alloc_{};
+	bool custom_ = false;		// true if alloc_ frees lines_
+
+	void
+	reset() noexcept
+	{
+		freeLinesEx(lines_, custom_ ? &alloc_ : nullptr);
+		lines_ = nullptr;
+		lengths_ = nullptr;
+		count_ = 0;
+	}
+
+	friend Lines readLines(const char *, std::error_code &, std::size_t,
+			std::pmr::memory_resource *) noexcept;
+};
+
+// readFile reads fileName as ::readFile does, with terminate true, storing
+// any error in ec and returning an empty FileBuffer if there is one.  If mr
+// is not null then the memory comes from it, and it must outlive the
+// FileBuffer.
+inline FileBuffer
+readFile(const char *fileName, std::error_code &ec, bool textMode = false,
+		std::size_t maxSize = 0, std::pmr::memory_resource *mr = nullptr)
+		noexcept
+{
+	ReadFileAllocator alloc = detail::pmrAllocator(mr);
+	const ReadFileAllocator *a = mr ? &alloc : nullptr;
+	std::size_t length;
+	char *buf;
+
+	errno = 0;
+	if (!(buf = readFileEx(fileName, textMode, true, maxSize, &length, a))) {
+		ec = detail::error();
+		return FileBuffer();
+	}
+	ec.clear();
+	return FileBuffer(buf, length, a);
+}
+
+// readFile reads fileName as above, but throws std::system_error on error.
+inline FileBuffer
+readFile(const char *fileName, bool textMode = false, std::size_t maxSize = 0,
+		std::pmr::memory_resource *mr = nullptr)
+{
+	std::error_code ec;
+	FileBuffer buf = readFile(fileName, ec, textMode, maxSize, mr);
+
+	if (ec)
+		throw std::system_error(ec, fileName ? fileName : "readFile");
+	return buf;
+}
+
+// readLines reads the lines of fileName as ::readLines does, storing any
+// error in ec and returning an empty Lines if there is one.  If mr is not
+// null then the memory comes from it, and it must outlive the Lines.
+inline Lines
+readLines(const char *fileName, std::error_code &ec, std::size_t maxSize = 0,
+		std::pmr::memory_resource *mr = nullptr) noexcept
+{
+	Lines lines;
+	ReadFileAllocator alloc = detail::pmrAllocator(mr);
+
+	errno = 0;
+	lines.lines_ = readLinesEx(fileName, maxSize, &lines.count_,
+			&lines.lengths_, mr ? &alloc : nullptr);
+	if (!lines.lines_) {
+		ec = detail::error();
+		return lines;
+	}
+	lines.alloc_ = alloc;
+	lines.custom_ = mr != nullptr;
+	ec.clear();
+	return lines;
+}
+
+// readLines reads the lines of fileName as above, but throws
+// std::system_error on error.
+inline Lines
+readLines(const char *fileName, std::size_t maxSize = 0,
+		std::pmr::memory_resource *mr = nullptr)
+{
+	std::error_code ec;
+	Lines lines = readLines(fileName, ec, maxSize, mr);
+
+	if (ec)
+		throw std::system_error(ec, fileName ? fileName : "readLines");
+	return lines;
+}
+
+}	// namespace readfile
+
+#endif	// READFILE_HPP_